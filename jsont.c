@@ -5,10 +5,10 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <limits.h>
-#include <ctype.h> // isdigit
 #include <errno.h>
 #include <string.h>
 #include <math.h>
+#include <stdio.h> // snprintf
 #include <assert.h>
 
 // Error info
@@ -20,36 +20,48 @@ DEF_EM(UNEXPECTED_OBJECT_END,
   "Unexpected end of object while not in an object");
 DEF_EM(UNEXPECTED_ARRAY_END, "Unexpected end of array while not in an array");
 DEF_EM(UNEXPECTED_COMMA, "Unexpected \",\"");
+DEF_EM(TRAILING_COMMA, "Unexpected \",\" before end of object or array");
 DEF_EM(UNEXPECTED_COLON, "Unexpected \":\"");
 DEF_EM(UNEXPECTED, "Unexpected input");
 DEF_EM(UNEXPECTED_UNICODE_SEQ, "Malformed unicode encoded sequence in string");
+DEF_EM(MALFORMED_NUMBER, "Malformed number literal");
+DEF_EM(PREMATURE_END, "Premature end of input");
+DEF_EM(UNTERMINATED_STRING, "Unterminated string");
+DEF_EM(BUFFER_FULL, "Builder buffer is full");
+DEF_EM(FLUSH_FAILED, "Builder flush function failed");
 #undef DEF_EM
 #endif
 
-// Size of stack used for structures (in/out array and objects). This value
-// is a balance between memory size of a ctx and how many levels deep the
-// tokenizer can go.
-#define _STRUCT_TYPE_STACK_SIZE 512
 #define _VALUE_BUF_MIN_SIZE 64
 
-static const uint8_t kHexValueTable[55] = {
-  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, // 0-0
-  -1, -1, -1, -1, -1, -1, -1,
-  10, 11, 12, 13, 14, 15, // A-F
-  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-  -1, -1, -1, -1, -1, -1, -1,
-  10, 11, 12, 13, 14, 15 // a-f
-};
-
 typedef uint8_t jsont_tok_t;
+typedef struct jsont_ctx jsont_ctx_t;
+
+typedef struct jsont_builder {
+  void* user_data;
+  uint8_t* buf;
+  size_t size;
+  size_t capacity;
+  bool external; // buf is owned by the caller
+  bool (*flush)(struct jsont_builder* b, const uint8_t* bytes, size_t length);
+  jsont_err_t error_info;
+  uint8_t state;
+} jsont_builder_t;
+
+#define _JSONT_IN_SOURCE
+#include <jsont.h>
+#include "jsont_kernels.h"
+
+// The scanner's tokens and limits are those of the public API
+typedef char _jsont_check_scan_tokens[
+  ((int)kScanTokenError == JSONT_ERR && (int)kScanTokenNull == JSONT_NULL &&
+   (int)kScanTokenInt == JSONT_NUMBER_INT &&
+   (int)kScanTokenFieldName == JSONT_FIELD_NAME &&
+   _JSONT_MAX_DEPTH == JSONT_MAX_DEPTH) ? 1 : -1];
 
-typedef struct jsont_ctx {
+struct jsont_ctx {
   void* user_data;
-  const uint8_t* input_buf;
-  const uint8_t* input_buf_ptr;
-  size_t input_len;
-  const uint8_t* input_buf_value_start;
-  const uint8_t* input_buf_value_end;
+  _jsont_scan_t scan; // input, current token and value, and nesting
   struct {
     uint8_t* data;
     size_t size;
@@ -57,39 +69,11 @@ typedef struct jsont_ctx {
     bool inuse;
   } value_buf;
   jsont_err_t error_info;
-  jsont_tok_t curr_tok;
-  size_t st_stack_size;
-  size_t st_stack_len;
-  jsont_tok_t st_stack[_STRUCT_TYPE_STACK_SIZE];
-} jsont_ctx_t;
-
-#define _JSONT_IN_SOURCE
-#include <jsont.h>
-
-unsigned long _hex_str_to_ul(const uint8_t* bytes, size_t len) {
-  unsigned long value = 0;
-  unsigned long cutoff = ULONG_MAX / 16;
-  int cutoff_digit = (int)(ULONG_MAX - cutoff * 16);
-
-  for (size_t i = 0; i != len; ++i) {
-    uint8_t b = bytes[i];
-    int digit = (b > '0'-1 && b < 'f'+1) ? kHexValueTable[b-'0'] : -1;
-    if (b == -1 || // bad digit
-        (value > cutoff) || // overflow
-        ((value == cutoff) && (digit > cutoff_digit)) ) {
-      return ULONG_MAX;
-    } else {
-      value = (value * 16) + digit;
-    }
-  }
-
-  return value;
-}
+};
 
 jsont_ctx_t* jsont_create(void* user_data) {
   jsont_ctx_t* ctx = (jsont_ctx_t*)calloc(1, sizeof(jsont_ctx_t));
   ctx->user_data = user_data;
-  ctx->st_stack_size = _STRUCT_TYPE_STACK_SIZE;
   return ctx;
 }
 
@@ -101,32 +85,45 @@ void jsont_destroy(jsont_ctx_t* ctx) {
 }
 
 void jsont_reset(jsont_ctx_t* ctx, const uint8_t* bytes, size_t length) {
-  ctx->input_buf_ptr = ctx->input_buf = bytes;
-  ctx->input_len = length;
-  ctx->st_stack_len = 0;
-  ctx->curr_tok = JSONT_END;
-  ctx->input_buf_value_start = 0;
-  ctx->input_buf_value_end = 0;
+  _jsont_scan_reset(&ctx->scan, bytes, length, false);
   ctx->value_buf.length = 0;
   ctx->value_buf.inuse = false;
   ctx->error_info = 0;
 }
 
+void jsont_reset_padded(jsont_ctx_t* ctx, const uint8_t* bytes,
+                        size_t length) {
+  jsont_reset(ctx, bytes, length);
+  ctx->scan.padded = true;
+}
+
+uint8_t* jsont_alloc_padded(size_t length) {
+  uint8_t* bytes = (uint8_t*)malloc(length + JSONT_PADDING);
+  if (bytes != 0) {
+    memset((void*)(bytes + length), 0, JSONT_PADDING);
+  }
+  return bytes;
+}
+
 jsont_tok_t jsont_current(const jsont_ctx_t* ctx) {
-  return ctx->curr_tok;
+  return ctx->scan.tok;
 }
 
 void* jsont_user_data(const jsont_ctx_t* ctx) {
   return ctx->user_data;
 }
 
+jsont_simd_t jsont_simd_level(void) {
+  return (jsont_simd_t)_jsont_simd_level();
+}
+
 // Get the current/last byte read. Suitable for debugging JSONT_ERR
 uint8_t jsont_current_byte(jsont_ctx_t* ctx) {
-  return (ctx->input_buf_ptr == 0) ? 0 : *(ctx->input_buf_ptr-1);
+  return (ctx->scan.offset == 0) ? 0 : ctx->scan.bytes[ctx->scan.offset-1];
 }
 
 size_t jsont_current_offset(jsont_ctx_t* ctx) {
-  return ctx->input_buf_ptr - ctx->input_buf;
+  return ctx->scan.offset;
 }
 
 jsont_err_t jsont_error_info(jsont_ctx_t* ctx) {
@@ -134,50 +131,68 @@ jsont_err_t jsont_error_info(jsont_ctx_t* ctx) {
 }
 
 inline static bool _no_value(jsont_ctx_t* ctx) {
-  return ctx->input_buf_value_start == 0
-      || ctx->curr_tok < _JSONT_VALUES_START
-      || ctx->curr_tok > _JSONT_VALUES_END;
+  return ctx->scan.tok < _JSONT_VALUES_START
+      || ctx->scan.tok > _JSONT_VALUES_END;
 }
 
-inline static size_t _input_avail(jsont_ctx_t* ctx) {
-  return ctx->input_len - (ctx->input_buf_ptr - ctx->input_buf);
+inline static const uint8_t* _value_start(jsont_ctx_t* ctx) {
+  return ctx->scan.bytes + ctx->scan.value_offset;
 }
 
-inline static uint8_t _next_byte(jsont_ctx_t* ctx) {
-  return (_input_avail(ctx) == 0) ? 0 : *(ctx->input_buf_ptr++);
+inline static const uint8_t* _value_end(jsont_ctx_t* ctx) {
+  return _value_start(ctx) + ctx->scan.value_length;
 }
 
-inline static jsont_tok_t _st_stack_top(const jsont_ctx_t* ctx) {
-  return (ctx->st_stack_len != 0) ? ctx->st_stack[ctx->st_stack_len-1]
-                                  : JSONT_END;
+// Unescapes the current value into value_buf
+static void _unescape_value(jsont_ctx_t* ctx) {
+  size_t len = ctx->scan.value_length;
+  if (ctx->value_buf.size < len) {
+    size_t size = (len < _VALUE_BUF_MIN_SIZE) ? _VALUE_BUF_MIN_SIZE : len;
+    ctx->value_buf.data = (uint8_t*)realloc(ctx->value_buf.data, size);
+    assert(ctx->value_buf.data != 0);
+    ctx->value_buf.size = size;
+  }
+  ctx->value_buf.length = _jsont_unescape(_value_start(ctx), _value_end(ctx),
+                                          ctx->value_buf.data);
+  ctx->value_buf.inuse = true;
 }
 
 size_t jsont_data_value(jsont_ctx_t* ctx, const uint8_t** bytes) {
   if (_no_value(ctx)) {
     return 0;
   } else {
+    if (ctx->scan.value_escaped && !ctx->value_buf.inuse) {
+      _unescape_value(ctx);
+    }
     if (ctx->value_buf.inuse) {
       *bytes = ctx->value_buf.data;
       return ctx->value_buf.length;
     } else {
-      *bytes = ctx->input_buf_value_start;
-      return ctx->input_buf_value_end - ctx->input_buf_value_start;
+      *bytes = _value_start(ctx);
+      return ctx->scan.value_length;
     }
   }
 }
 
+size_t jsont_unescape(const uint8_t* bytes, size_t length, uint8_t* dst) {
+  return _jsont_unescape(bytes, bytes + length, dst);
+}
+
 bool jsont_data_equals(jsont_ctx_t* ctx, const uint8_t* bytes, size_t length) {
-  if (ctx->value_buf.inuse) {
+  if (ctx->scan.value_escaped && !ctx->value_buf.inuse) {
+    // Compare against the escaped form rather than unescaping
+    return _jsont_unescaped_equals(_value_start(ctx), _value_end(ctx), bytes,
+                                   length);
+  } else if (ctx->value_buf.inuse) {
     return (ctx->value_buf.length == length) &&
       (memcmp((const void*)ctx->value_buf.data,
         (const void*)bytes, length) == 0);
   } else {
-    return (ctx->input_buf_value_end - ctx->input_buf_value_start == length) &&
-      (memcmp((const void*)ctx->input_buf_value_start,
+    return (ctx->scan.value_length == length) &&
+      (memcmp((const void*)_value_start(ctx),
         (const void*)bytes, length) == 0);
   }
 }
-
 char* jsont_strcpy_value(jsont_ctx_t* ctx) {
   if (_no_value(ctx)) {
     return 0;
@@ -258,16 +273,8 @@ int64_t jsont_int_value(jsont_ctx_t* ctx) {
   return (int64_t)acc;
 }
 
-#ifdef NAN
-  #define _JSONT_NAN NAN
-#else
-  #define _JSONT_NAN nan(0)
-#endif
-
 double jsont_float_value(jsont_ctx_t* ctx) {
-  // Note: This might cause a segfault if the input is at the end, so we cause
-  // an error if we try to read a float value while at the end of the input.
-  if (_no_value(ctx) || _input_avail(ctx) == 0) {
+  if (_no_value(ctx)) {
     errno = EINVAL;
     return _JSONT_NAN;
   }
@@ -277,293 +284,353 @@ double jsont_float_value(jsont_ctx_t* ctx) {
   if (len == 0) {
     return _JSONT_NAN;
   }
-  return atof((const char*)bytes);
+  // A number at the very end of unpadded input, or an unescaped string, has
+  // no terminating byte and is copied
+  bool terminated = !ctx->value_buf.inuse &&
+    (ctx->scan.value_offset + len != ctx->scan.length || ctx->scan.padded);
+  return _jsont_parse_float((const char*)bytes, len, terminated);
 }
 
-inline static jsont_tok_t _set_tok(jsont_ctx_t* ctx, jsont_tok_t tok) {
-  ctx->curr_tok = tok;
+// Translates the scanner's kScanError* reasons for jsont_next
+static jsont_tok_t _jsont_next_error(jsont_ctx_t* ctx) {
+  _jsont_scan_t* s = &ctx->scan;
+  switch (s->error) {
+    case kScanErrorPrematureEnd:
+      ctx->error_info = JSONT_ERRINFO_PREMATURE_END; break;
+    case kScanErrorUnterminatedString:
+      ctx->error_info = JSONT_ERRINFO_UNTERMINATED_STRING; break;
+    case kScanErrorUnexpectedComma:
+      ctx->error_info = JSONT_ERRINFO_UNEXPECTED_COMMA; break;
+    case kScanErrorTrailingComma:
+      ctx->error_info = JSONT_ERRINFO_TRAILING_COMMA; break;
+    case kScanErrorUnexpectedColon:
+      ctx->error_info = JSONT_ERRINFO_UNEXPECTED_COLON; break;
+    case kScanErrorMalformedNumber:
+      ctx->error_info = JSONT_ERRINFO_MALFORMED_NUMBER; break;
+    case kScanErrorMalformedUnicode:
+      ctx->error_info = JSONT_ERRINFO_UNEXPECTED_UNICODE_SEQ; break;
+    case kScanErrorUnexpectedObjectEnd:
+      ctx->error_info = JSONT_ERRINFO_UNEXPECTED_OBJECT_END; break;
+    case kScanErrorUnexpectedArrayEnd:
+      ctx->error_info = JSONT_ERRINFO_UNEXPECTED_ARRAY_END; break;
+    case kScanErrorTooDeep:
+      ctx->error_info = JSONT_ERRINFO_STACK_SIZE; break;
+    default:
+      ctx->error_info = JSONT_ERRINFO_UNEXPECTED; break;
+  }
+  return JSONT_ERR;
+}
 
-  if (tok != JSONT_END) {
-    if (tok == JSONT_OBJECT_START) {
-      if (ctx->st_stack_len == ctx->st_stack_size) {
-        ctx->error_info = JSONT_ERRINFO_STACK_SIZE;
-        return ctx->curr_tok = JSONT_ERR; // TODO: Grow st_stack
-      }
-       ctx->st_stack[ctx->st_stack_len++] = JSONT_OBJECT_START;
+jsont_tok_t jsont_next(jsont_ctx_t* ctx) {
+  // The scanner in jsont_scan_next.h is shared with the C++ tokenizer
+  _jsont_scan_t* s = &ctx->scan;
+  ctx->value_buf.inuse = false;
+  #define _JSONT_SCAN_RETURN(token) \
+    return ((token) == kScanTokenError) ? _jsont_next_error(ctx) \
+                                        : (jsont_tok_t)(token)
+  #include "jsont_scan_next.h"
+  #undef _JSONT_SCAN_RETURN
+}
 
-    } else if (tok == JSONT_OBJECT_END) {
-      if (_st_stack_top(ctx) != JSONT_OBJECT_START) {
-        ctx->error_info = JSONT_ERRINFO_UNEXPECTED_OBJECT_END;
-        return ctx->curr_tok = JSONT_ERR;
-      }
-      --ctx->st_stack_len;
+size_t jsont_next_batch(jsont_ctx_t* ctx, jsont_record_t* records, size_t max) {
+  size_t n = 0;
+  while (n != max) {
+    jsont_record_t* r = &records[n++];
+    r->tok = jsont_next(ctx);
+    r->flags = 0;
+    switch (r->tok) {
+      case JSONT_NUMBER_INT: case JSONT_NUMBER_FLOAT:
+      case JSONT_STRING: case JSONT_FIELD_NAME:
+        r->offset = ctx->scan.value_offset;
+        r->length = ctx->scan.value_length;
+        if (ctx->scan.value_escaped) {
+          r->flags = JSONT_RECORD_ESCAPED;
+        }
+        break;
+      case JSONT_END: case JSONT_ERR:
+        r->offset = ctx->scan.offset;
+        r->length = 0;
+        return n;
+      default:
+        r->offset = ctx->scan.start;
+        r->length = ctx->scan.offset - ctx->scan.start;
+        break;
+    }
+  }
+  return n;
+}
 
-    } else if (tok == JSONT_ARRAY_START) {
-      if (ctx->st_stack_len == ctx->st_stack_size) {
-        ctx->error_info = JSONT_ERRINFO_STACK_SIZE;
-        return ctx->curr_tok = JSONT_ERR;
-      }
-       ctx->st_stack[ctx->st_stack_len++] = JSONT_ARRAY_START;
 
-    } else if (tok == JSONT_ARRAY_END) {
-      if (_st_stack_top(ctx) != JSONT_ARRAY_START) {
-        ctx->error_info = JSONT_ERRINFO_UNEXPECTED_ARRAY_END;
-        return ctx->curr_tok = JSONT_ERR;
-      }
-      --ctx->st_stack_len;
-    }
+// ----------------- Builder -----------------
+
+// Builder states, deciding what separator precedes the next value
+enum {
+  _JSONT_B_NEUTRAL = 0,
+  _JSONT_B_AFTER_FIELD_NAME,
+  _JSONT_B_AFTER_VALUE,
+  _JSONT_B_AFTER_STRUCT_START,
+};
+
+jsont_builder_t* jsont_builder_create(void* user_data) {
+  jsont_builder_t* b = (jsont_builder_t*)calloc(1, sizeof(jsont_builder_t));
+  b->user_data = user_data;
+  return b;
+}
+
+void jsont_builder_destroy(jsont_builder_t* b) {
+  if (b->buf != 0 && !b->external) {
+    free(b->buf);
   }
+  free(b);
+}
 
-  return tok;
+void jsont_builder_reset(jsont_builder_t* b) {
+  b->size = 0;
+  b->state = _JSONT_B_NEUTRAL;
+  b->error_info = 0;
 }
-inline static void _rewind_one_byte(jsont_ctx_t* ctx) {
-  --ctx->input_buf_ptr;
+
+void jsont_builder_set_buffer(jsont_builder_t* b, uint8_t* buf,
+                              size_t capacity) {
+  if (b->buf != 0 && !b->external) {
+    free(b->buf);
+  }
+  b->buf = buf;
+  b->capacity = capacity;
+  b->external = true;
+  jsont_builder_reset(b);
 }
-inline static void _rewind_bytes(jsont_ctx_t* ctx, size_t n) {
-  ctx->input_buf_ptr -= n;
+
+void jsont_builder_set_flush(jsont_builder_t* b, jsont_flush_fn flush) {
+  b->flush = flush;
 }
-inline static void _skip_bytes(jsont_ctx_t* ctx, size_t n) {
-  ctx->input_buf_ptr += n;
+
+void* jsont_builder_user_data(const jsont_builder_t* b) {
+  return b->user_data;
 }
-inline static uint8_t _read_atom(jsont_ctx_t* ctx, size_t slacklen,
-                                 jsont_tok_t tok) {
-  if (_input_avail(ctx) < slacklen) {
-    // rewind and wait for buffer fill
-    _rewind_one_byte(ctx);
-    return _set_tok(ctx, JSONT_END);
-  } else {
-    _skip_bytes(ctx, slacklen); // e.g. "ull" after "n" or "alse" after "f"
-    return _set_tok(ctx, tok);
-  }
+
+jsont_err_t jsont_builder_error_info(const jsont_builder_t* b) {
+  return b->error_info;
 }
-inline static bool _expects_field_name(jsont_ctx_t* ctx) {
-  return (   ctx->curr_tok == JSONT_OBJECT_START
-          || (   ctx->curr_tok == _JSONT_COMMA
-              && _st_stack_top(ctx) == JSONT_OBJECT_START) );
+
+const uint8_t* jsont_builder_bytes(const jsont_builder_t* b, size_t* length) {
+  *length = b->size;
+  return (b->size == 0) ? 0 : b->buf;
 }
 
-static void _value_buf_append(jsont_ctx_t* ctx, const uint8_t* data, size_t len) {
-  //printf("_value_buf_append(<ctx>, %p, %zu)\n", data, len);
-  if (ctx->value_buf.size == 0) {
-    assert(ctx->value_buf.data == 0);
-    ctx->value_buf.length = len;
-    ctx->value_buf.size = len * 2;
-    if (ctx->value_buf.size < _VALUE_BUF_MIN_SIZE) {
-      ctx->value_buf.size = _VALUE_BUF_MIN_SIZE;
+inline static bool _b_fail(jsont_builder_t* b, jsont_err_t error_info) {
+  b->error_info = error_info;
+  return false;
+}
+
+bool jsont_builder_flush(jsont_builder_t* b) {
+  if (b->error_info != 0) {
+    return false;
+  }
+  if (b->size != 0 && b->flush != 0) {
+    if (!b->flush(b, b->buf, b->size)) {
+      return _b_fail(b, JSONT_ERRINFO_FLUSH_FAILED);
     }
-    ctx->value_buf.data = (uint8_t*)malloc(ctx->value_buf.size);
-    if (len != 0) {
-      memcpy(ctx->value_buf.data, data, len);
+    b->size = 0;
+  }
+  return true;
+}
+
+// Slow path of `_b_reserve`
+static bool _b_grow(jsont_builder_t* b, size_t n) {
+  if (b->error_info != 0) {
+    return false;
+  }
+  if (b->flush != 0 && b->size != 0) {
+    if (!jsont_builder_flush(b)) {
+      return false;
     }
-  } else {
-    if (ctx->value_buf.length + len > ctx->value_buf.size) {
-      size_t new_size = ctx->value_buf.size + (len * 2);
-      ctx->value_buf.data = realloc(ctx->value_buf.data, new_size);
-      assert(ctx->value_buf.data != 0);
-      ctx->value_buf.size = new_size;
+    if (b->capacity >= n) {
+      return true;
     }
-    memcpy(ctx->value_buf.data + ctx->value_buf.length, data, len);
-    ctx->value_buf.length += len;
   }
-  ctx->value_buf.inuse = true;
+  if (b->external) {
+    return _b_fail(b, JSONT_ERRINFO_BUFFER_FULL);
+  }
+  size_t capacity = b->size + n;
+  capacity = (capacity < 64) ? 64 : (capacity + (capacity / 2));
+  uint8_t* buf = (uint8_t*)realloc(b->buf, capacity);
+  if (buf == 0) {
+    return _b_fail(b, JSONT_ERRINFO_BUFFER_FULL);
+  }
+  b->buf = buf;
+  b->capacity = capacity;
+  return true;
 }
 
-jsont_tok_t jsont_next(jsont_ctx_t* ctx) {
-  //
-  // { } [ ] n t f "
-  //         | | | |
-  //         | | | +- /[^"]*/ "
-  //         | | +- a l s e
-  //         | +- r u e
-  //         +- u l l
-  //
-  while (1) {
-    uint8_t b = _next_byte(ctx);
-    switch (b) {
-      case '{': return _set_tok(ctx, JSONT_OBJECT_START);
-      case '}': return _set_tok(ctx, JSONT_OBJECT_END);
-      case '[': return _set_tok(ctx, JSONT_ARRAY_START);
-      case ']': return _set_tok(ctx, JSONT_ARRAY_END);
-      case 'n': return _read_atom(ctx, 3, JSONT_NULL);
-      case 't': return _read_atom(ctx, 3, JSONT_TRUE);
-      case 'f': return _read_atom(ctx, 4, JSONT_FALSE);
-      case '"': {
-        ctx->input_buf_value_start = ctx->input_buf_ptr;
-        ctx->value_buf.inuse = false;
-        ctx->value_buf.length = 0;
-        uint8_t prev_b = 0;
-        while (1) {
-          b = _next_byte(ctx);
-
-          if (b == '\\') {
-            if (prev_b == '\\') {
-              // This is an actual '\'.
-              assert(ctx->value_buf.inuse == true); // should be buffering
-              _value_buf_append(ctx, ctx->input_buf_ptr-1, 1); // append "\"
-            } else {
-              // Okay, this is an escape prefix. Move to buffering value.
-              if (ctx->value_buf.inuse == 0) {
-                _value_buf_append(ctx,
-                  ctx->input_buf_value_start,
-                  // any data before the "\":
-                  (ctx->input_buf_ptr-1 - ctx->input_buf_value_start) );
-              }
-            }
-          } else {
-            // Any byte except '\'
-
-            if (prev_b == '\\') {
-              // Currently just after an escape character
-              assert(ctx->value_buf.inuse == true); // should be buffering
-
-              // JSON specifies a few "magic" characters that have a different
-              // meaning than their value:
-              switch (b) {
-              case 'b':
-                _value_buf_append(ctx, (const uint8_t*)"\b", 1);
-                break;
-              case 'f':
-                _value_buf_append(ctx, (const uint8_t*)"\f", 1);
-                break;
-              case 'n':
-                _value_buf_append(ctx, (const uint8_t*)"\n", 1);
-                break;
-              case 'r':
-                _value_buf_append(ctx, (const uint8_t*)"\r", 1);
-                break;
-              case 't':
-                _value_buf_append(ctx, (const uint8_t*)"\t", 1);
-                break;
-              case 'u': {
-                // 4 hex digits should follow
-                if (_input_avail(ctx) < 4) {
-                  _rewind_bytes(ctx,
-                    ctx->input_buf_ptr - (ctx->input_buf_value_start-1));
-                  return _set_tok(ctx, JSONT_END);
-                }
-                unsigned long utf16cp = _hex_str_to_ul(ctx->input_buf_ptr, 4);
-                ctx->input_buf_ptr += 4;
-                if (utf16cp == ULONG_MAX) {
-                  ctx->error_info = JSONT_ERRINFO_UNEXPECTED_UNICODE_SEQ;
-                  return _set_tok(ctx, JSONT_ERR);
-                }
-
-                uint32_t cp = (uint16_t)(0xffff & utf16cp);
-
-                // Is lead surrogate?
-                if (cp >= 0xd800u && cp <= 0xdbffu) {
-                  // TODO: Implement pairs by reading another "\uHHHH"
-                  ctx->error_info = JSONT_ERRINFO_UNEXPECTED_UNICODE_SEQ;
-                  return _set_tok(ctx, JSONT_ERR);
-                }
-
-                // Append UTF-8 byte(s) representing the Unicode codepoint `cp`
-                if (cp < 0x80) {
-                  uint8_t cp8 = ((uint8_t)cp);
-                  _value_buf_append(ctx, (const uint8_t*)&cp8, 1);
-                } else if (cp < 0x800) {
-                  uint8_t cp8 = (uint8_t)((cp >> 6) | 0xc0);
-                  _value_buf_append(ctx, (const uint8_t*)&cp8, 1);
-                  cp8 = (uint8_t)((cp & 0x3f) | 0x80);
-                  _value_buf_append(ctx, (const uint8_t*)&cp8, 1);
-                } else {
-                  uint8_t cp8 = (uint8_t)((cp >> 12) | 0xe0);
-                  _value_buf_append(ctx, (const uint8_t*)&cp8, 1);
-                  cp8 = (uint8_t)(((cp >> 6) & 0x3f) | 0x80);
-                  _value_buf_append(ctx, (const uint8_t*)&cp8, 1);
-                  cp8 = (uint8_t)((cp & 0x3f) | 0x80);
-                  _value_buf_append(ctx, (const uint8_t*)&cp8, 1);
-                }
-
-                break;
-              }
-              default: {
-                _value_buf_append(ctx, &b, 1);
-                break;
-              }
-              } // switch
-
-            } else {
-              // Previous character was NOT an escape character
-
-              if (b == '"') {
-                // Well, this marks the end of a string
-                ctx->input_buf_value_end = ctx->input_buf_ptr-1;
-                return _set_tok(ctx, _expects_field_name(ctx)
-                  ? JSONT_FIELD_NAME : JSONT_STRING);
-                break;
-              } else if (b == 0) {
-                // Input buffer ends in the middle of a string
-                _rewind_bytes(ctx,
-                  ctx->input_buf_ptr - (ctx->input_buf_value_start-1));
-                return _set_tok(ctx, JSONT_END);
-              } else {
-                if (ctx->value_buf.inuse) {
-                  _value_buf_append(ctx, &b, 1);
-                }
-              }
-            }
-          }
-
-          prev_b = b;
-        }
+// Make room for at least `n` more bytes
+inline static bool _b_reserve(jsont_builder_t* b, size_t n) {
+  return (b->capacity - b->size >= n) || _b_grow(b, n);
+}
+
+// Append `length` bytes, flushing as many times as needed when a flush
+// function is set
+static bool _b_append(jsont_builder_t* b, const uint8_t* bytes, size_t length) {
+  while (b->capacity - b->size < length) {
+    if (b->flush == 0 || b->capacity == 0) {
+      // Grow (or fail) to fit all of it
+      if (!_b_grow(b, length)) {
+        return false;
       }
-      case ',':
-        if (   ctx->curr_tok == JSONT_OBJECT_START
-            || ctx->curr_tok == JSONT_ARRAY_START
-            || ctx->curr_tok == JSONT_END
-            || ctx->curr_tok == JSONT_ERR) {
-          if (ctx->curr_tok != JSONT_ERR)
-            ctx->error_info = JSONT_ERRINFO_UNEXPECTED_COMMA;
-          return _set_tok(ctx, JSONT_ERR);
-        }
-        _set_tok(ctx, _JSONT_COMMA);
-        // read next by simply letting the outer "while" do its thing
-        break;
+      break;
+    }
+    size_t z = b->capacity - b->size;
+    memcpy(b->buf + b->size, bytes, z);
+    b->size += z;
+    bytes += z;
+    length -= z;
+    if (!jsont_builder_flush(b)) {
+      return false;
+    }
+  }
+  memcpy(b->buf + b->size, bytes, length);
+  b->size += length;
+  return true;
+}
 
-      case ':':
-        if (ctx->curr_tok != JSONT_FIELD_NAME) {
-          ctx->error_info = JSONT_ERRINFO_UNEXPECTED_COLON;
-          return _set_tok(ctx, JSONT_ERR);
-        }
-        // let the outer "while" do its thing
-        break;
+inline static bool _b_append_byte(jsont_builder_t* b, uint8_t byte) {
+  if (!_b_reserve(b, 1)) {
+    return false;
+  }
+  b->buf[b->size++] = byte;
+  return true;
+}
+
+// Adds any separator needed before a value or field name
+inline static bool _b_prefix(jsont_builder_t* b) {
+  if (b->error_info != 0) {
+    return false;
+  }
+  if (b->state == _JSONT_B_AFTER_FIELD_NAME) {
+    return _b_append_byte(b, ':');
+  } else if (b->state == _JSONT_B_AFTER_VALUE) {
+    return _b_append_byte(b, ',');
+  }
+  return true;
+}
 
-      case ' ': case '\r': case '\n': case '\t':
-        // ignore whitespace and let the outer "while" do its thing
+static bool _b_append_string(jsont_builder_t* b, const uint8_t* v,
+                             size_t length) {
+  const uint8_t* end = v + length;
+  if (!_b_append_byte(b, '"')) {
+    return false;
+  }
+  while (v != end) {
+    // Copy any run of bytes which need no escaping in one go
+    const uint8_t* run = _jsont_find_escape(v, end, false);
+    if (run != v) {
+      if (!_b_append(b, v, run - v)) {
+        return false;
+      }
+      v = run;
+      if (v == end) {
         break;
+      }
+    }
+    char esc[6];
+    if (!_b_append(b, (const uint8_t*)esc, _jsont_escape_ascii(esc, *v++))) {
+      return false;
+    }
+  }
+  return _b_append_byte(b, '"');
+}
 
-      case 0:
-        //printf("** %d\n", __LINE__);
-        return _set_tok(ctx, JSONT_END);
+bool jsont_builder_object_start(jsont_builder_t* b) {
+  if (!_b_prefix(b)) {
+    return false;
+  }
+  b->state = _JSONT_B_AFTER_STRUCT_START;
+  return _b_append_byte(b, '{');
+}
 
-      default:
-        if (isdigit((int)b) || b == '+' || b == '-') {
-          // We are reading a number
-          ctx->input_buf_value_start = ctx->input_buf_ptr-1;
-          //uint8_t prev_b = 0;
-          bool is_float = false;
-          while (1) {
-            b = _next_byte(ctx);
-            if (b == '.') {
-              is_float = true;
-            } else if (!isdigit((int)b)) {
-              _rewind_one_byte(ctx);
-              ctx->input_buf_value_end = ctx->input_buf_ptr;
-              return _set_tok(ctx, is_float ? JSONT_NUMBER_FLOAT
-                                            : JSONT_NUMBER_INT);
-            } else if (b == 0) {
-              // Input buffer ends before we know that the number-value ended
-              _rewind_bytes(ctx, ctx->input_buf_ptr
-                                 - (ctx->input_buf_value_start-1));
-              return _set_tok(ctx, JSONT_END);
-            }
-          }
-        }
+bool jsont_builder_object_end(jsont_builder_t* b) {
+  if (b->error_info != 0) {
+    return false;
+  }
+  b->state = _JSONT_B_AFTER_VALUE;
+  return _b_append_byte(b, '}');
+}
 
-        ctx->error_info = JSONT_ERRINFO_UNEXPECTED;
-        return _set_tok(ctx, JSONT_ERR);
-    }
-  } // while (1)
+bool jsont_builder_array_start(jsont_builder_t* b) {
+  if (!_b_prefix(b)) {
+    return false;
+  }
+  b->state = _JSONT_B_AFTER_STRUCT_START;
+  return _b_append_byte(b, '[');
+}
+
+bool jsont_builder_array_end(jsont_builder_t* b) {
+  if (b->error_info != 0) {
+    return false;
+  }
+  b->state = _JSONT_B_AFTER_VALUE;
+  return _b_append_byte(b, ']');
 }
 
+bool jsont_builder_field(jsont_builder_t* b, const uint8_t* name,
+                         size_t length) {
+  if (!_b_prefix(b)) {
+    return false;
+  }
+  b->state = _JSONT_B_AFTER_FIELD_NAME;
+  return _b_append_string(b, name, length);
+}
+
+bool jsont_builder_string(jsont_builder_t* b, const uint8_t* bytes,
+                          size_t length) {
+  if (!_b_prefix(b)) {
+    return false;
+  }
+  b->state = _JSONT_B_AFTER_VALUE;
+  return _b_append_string(b, bytes, length);
+}
+
+bool jsont_builder_int(jsont_builder_t* b, int64_t v) {
+  if (!_b_prefix(b)) {
+    return false;
+  }
+  char buf[_JSONT_INT64_MAX_LENGTH];
+  size_t z = _jsont_format_int64(buf, v);
+  b->state = _JSONT_B_AFTER_VALUE;
+  return _b_append(b, (const uint8_t*)buf, z);
+}
+
+bool jsont_builder_double(jsont_builder_t* b, double v) {
+  if (!_b_prefix(b)) {
+    return false;
+  }
+  char buf[_JSONT_DOUBLE_MAX_LENGTH + 1];
+  int z = snprintf(buf, sizeof(buf), "%g", v);
+  b->state = _JSONT_B_AFTER_VALUE;
+  return _b_append(b, (const uint8_t*)buf, z);
+}
+
+bool jsont_builder_bool(jsont_builder_t* b, bool v) {
+  if (!_b_prefix(b)) {
+    return false;
+  }
+  b->state = _JSONT_B_AFTER_VALUE;
+  return v ? _b_append(b, (const uint8_t*)"true", 4)
+           : _b_append(b, (const uint8_t*)"false", 5);
+}
+
+bool jsont_builder_null(jsont_builder_t* b) {
+  if (!_b_prefix(b)) {
+    return false;
+  }
+  b->state = _JSONT_B_AFTER_VALUE;
+  return _b_append(b, (const uint8_t*)"null", 4);
+}
+
+bool jsont_builder_raw(jsont_builder_t* b, const uint8_t* json, size_t length) {
+  if (!_b_prefix(b)) {
+    return false;
+  }
+  b->state = _JSONT_B_AFTER_VALUE;
+  return _b_append(b, json, length);
+}
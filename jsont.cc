@@ -1,45 +1,11 @@
 #include "jsont.hh"
+#include "jsont_kernels.h"
+#include <algorithm> // sort
+#include <stdio.h> // snprintf
 
 namespace jsont {
 
-static const int8_t kHexValueTable[55] = {
-  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, // 0-0
-  -1, -1, -1, -1, -1, -1, -1,
-  10, 11, 12, 13, 14, 15, // A-F
-  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-  -1, -1, -1, -1, -1, -1, -1,
-  10, 11, 12, 13, 14, 15 // a-f
-};
-
-static uint64_t _xtou64(const uint8_t* bytes, size_t len) {
-  uint64_t value = 0;
-  uint64_t cutoff = UINT64_MAX / 16;
-  int cutoff_digit = (int)(UINT64_MAX - cutoff * 16);
-
-  for (size_t i = 0; i != len; ++i) {
-    uint8_t b = bytes[i];
-    int8_t digit = (b > '0'-1 && b < 'f'+1) ? kHexValueTable[b-'0'] : -1;
-    if (b == -1 || // bad digit
-        (value > cutoff) || // overflow
-        ((value == cutoff) && (digit > cutoff_digit)) ) {
-      return UINT64_MAX;
-    } else {
-      value = (value * 16) + digit;
-    }
-  }
-
-  return value;
-}
-
-
-#ifdef NAN
-  #define _JSONT_NAN NAN
-#else
-  #define _JSONT_NAN nan(0)
-#endif
-
-
-const char* token_name(jsont::Token tok) {
+JSONT_INLINE const char* token_name(jsont::Token tok) {
   switch (tok) {
     case End:         return "End";
     case ObjectStart: return "ObjectStart";
@@ -58,42 +24,46 @@ const char* token_name(jsont::Token tok) {
 }
 
 
-class TokenizerInternal {
-public:
-  inline static const uint8_t* currentInput(const Tokenizer& self) {
-    return self._input.bytes + self._input.offset;
-  }
-
-  inline static const Token& readAtom(Tokenizer& self, const char* str,
-        size_t len, const Token& token) {
-    if (self.availableInput() < len) {
-      return self.setError(Tokenizer::PrematureEndOfInput);
-    } else if (memcmp(currentInput(self), str, len) != 0) {
-      return self.setError(Tokenizer::InvalidByte);
-    } else {
-      self._input.offset += len;
-      return self.setToken(token);
-    }
-  }
-};
+JSONT_INLINE SIMDLevel simdLevel() {
+  return (SIMDLevel)_jsont_simd_level();
+}
 
 
-Tokenizer::~Tokenizer() {}
+JSONT_INLINE Tokenizer::~Tokenizer() {}
 
 
-void Tokenizer::reset(const char* bytes, size_t length, TextEncoding encoding) {
+JSONT_INLINE void Tokenizer::reset(const char* bytes, size_t length, TextEncoding encoding) {
   assert(encoding == UTF8TextEncoding); // only supported encoding
-  _input.bytes = (const uint8_t*)bytes;
-  _input.length = length;
-  _input.offset = 0;
-  _error.code = UnspecifiedError;
+  _jsont_scan_reset(&_scan, (const uint8_t*)bytes, length, false);
   // Advance to first token
   next();
 }
 
 
-const char* Tokenizer::errorMessage() const {
-  switch (_error.code) {
+JSONT_INLINE void Tokenizer::resetPadded(const char* bytes, size_t length,
+                                         TextEncoding encoding) {
+  assert(encoding == UTF8TextEncoding); // only supported encoding
+  _jsont_scan_reset(&_scan, (const uint8_t*)bytes, length, true);
+  next();
+}
+
+
+JSONT_INLINE char* Tokenizer::allocPadded(size_t length) {
+  char* bytes = (char*)malloc(length + Padding);
+  if (bytes != 0) {
+    memset((void*)(bytes + length), 0, Padding);
+  }
+  return bytes;
+}
+
+
+JSONT_INLINE Tokenizer::ErrorCode Tokenizer::error() const {
+  return _error_code_of(_scan.error);
+}
+
+
+JSONT_INLINE const char* Tokenizer::errorMessage() const {
+  switch (error()) {
     case UnexpectedComma:
       return "Unexpected comma";
     case UnexpectedTrailingComma:
@@ -110,341 +80,243 @@ const char* Tokenizer::errorMessage() const {
       return "Unterminated string";
     case SyntaxError:
       return "Illegal JSON (syntax error)";
+    case UnexpectedColon:
+      return "Unexpected colon";
+    case UnexpectedObjectEnd:
+      return "Unexpected end of object while not in an object";
+    case UnexpectedArrayEnd:
+      return "Unexpected end of array while not in an array";
+    case NestingTooDeep:
+      return "Objects and arrays nested too deep";
     default:
       return "Unspecified error";
   }
 }
 
 
-size_t Tokenizer::dataValue(const char const** bytes) const {
+JSONT_INLINE void Tokenizer::unescape() const {
+  if (!_value.buffered) {
+    const uint8_t* p = _scan.bytes + _scan.value_offset;
+    _value.buffer.resize(_scan.value_length);
+    _value.buffer.resize(
+      _jsont_unescape(p, p + _scan.value_length, (uint8_t*)&_value.buffer[0]));
+    _value.buffered = true;
+  }
+}
+
+JSONT_INLINE size_t Tokenizer::dataValue(const char** bytes) const {
   if (!hasValue()) { return 0; }
-  if (_value.buffered) {
-    *bytes = (const char const*)_value.buffer.data();
+  if (_scan.value_escaped) {
+    unescape();
+    *bytes = (const char*)_value.buffer.data();
     return _value.buffer.size();
   } else {
-    *bytes = (const char const*)(_input.bytes + _value.offset);
-    return _value.length;
+    *bytes = (const char*)(_scan.bytes + _scan.value_offset);
+    return _scan.value_length;
   }
 }
 
 
-double Tokenizer::floatValue() const {
-  if (!hasValue()) {
-    return _token == jsont::True ? 1.0 : 0.0;
+JSONT_INLINE size_t Tokenizer::rawValue(const char** bytes) {
+  switch (_token) {
+    case ObjectStart: case ArrayStart:
+      break;
+    case String:
+      // including quotes
+      *bytes = (const char*)(_scan.bytes + _scan.start);
+      return _scan.value_length + 2;
+    case True: case False: case Null: case Integer: case Float:
+      *bytes = (const char*)(_scan.bytes + _scan.start);
+      return _scan.offset - _scan.start;
+    default:
+      return 0;
   }
 
-  const char* bytes;
-
-  if (_value.buffered) {
-    // edge-case since only happens with string values using escape sequences
-    bytes = _value.buffer.c_str();
-  } else {
-    bytes = (const char*)_input.bytes + _value.offset;
-    if (availableInput() == 0) {
-      // In this case where the data lies at the edge of the buffer, we can't pass
-      // it directly to atof, since there will be no sentinel byte. We are fine
-      // with a copy, since this is an edge case (only happens either for broken
-      // JSON or when the whole document is just a number).
-      char* buf[128];
-      if (_value.length > 127) {
-        // We are unable to interpret such a large literal in this edge-case
-        return _JSONT_NAN;
+  // Match brackets on the scanner's stack, which holds the opening one, and
+  // skip over strings
+  size_t start = _scan.start;
+  size_t depth = _scan.depth;
+  const uint8_t* p = _scan.bytes + _scan.offset;
+  const uint8_t* end = _scan.bytes + _scan.length;
+  while (p != end) {
+    uint8_t b = *p++;
+    switch (b) {
+      case '{': case '[':
+        if (!_jsont_scan_push(&_scan, b == '{')) {
+          _scan.offset = p - _scan.bytes;
+          setError(kScanErrorTooDeep);
+          return 0;
+        }
+        break;
+      case '}': case ']': {
+        size_t d = _scan.depth - 1;
+        bool object = (_scan.stack[d / 64] >> (d % 64)) & 1;
+        if (object != (b == '}')) {
+          _scan.offset = p - _scan.bytes;
+          setError(object ? kScanErrorUnexpectedArrayEnd
+                          : kScanErrorUnexpectedObjectEnd);
+          return 0;
+        }
+        _jsont_scan_pop(&_scan);
+        if (_scan.depth == depth - 1) {
+          _scan.offset = p - _scan.bytes;
+          _scan.start = _scan.offset - 1;
+          _token = object ? ObjectEnd : ArrayEnd;
+          _scan.tok = object ? kScanTokenObjectEnd : kScanTokenArrayEnd;
+          *bytes = (const char*)(_scan.bytes + start);
+          return _scan.offset - start;
+        }
+        break;
       }
-      memcpy((void*)buf, (const void*)bytes, _value.length);
-      buf[_value.length] = '\0';
-      return strtod((const char*)buf, (char**)0);
+      case '"':
+        for (;;) {
+          p = _jsont_find_string_end(p, end);
+          if (p == end || *p == 0) {
+            _scan.offset = p - _scan.bytes;
+            setError(kScanErrorUnterminatedString);
+            return 0;
+          }
+          if (*p++ == '"') {
+            break;
+          }
+          if (p != end) { // the escaped byte
+            ++p;
+          }
+        }
+        break;
+      case 0: // ends the input
+        end = --p;
+        break;
     }
   }
+  _scan.offset = end - _scan.bytes;
+  setError(kScanErrorPrematureEnd);
+  return 0;
+}
+
 
-  return strtod(bytes, (char**)0);
+JSONT_INLINE double Tokenizer::floatValue() const {
+  if (!hasValue()) {
+    return _token == jsont::True ? 1.0 : 0.0;
+  }
+  if (_scan.value_escaped) {
+    // edge-case since only happens with string values using escape sequences
+    unescape();
+    return strtod(_value.buffer.c_str(), (char**)0);
+  }
+  return _jsont_parse_float((const char*)_scan.bytes + _scan.value_offset,
+                            _scan.value_length, valueTerminated());
 }
 
 
-int64_t Tokenizer::intValue() const {
+JSONT_INLINE int64_t Tokenizer::intValue() const {
   if (!hasValue()) {
     return _token == jsont::True ? 1LL : 0LL;
   }
+  if (_scan.value_escaped) {
+    // edge-case since only happens with string values using escape sequences
+    unescape();
+    return strtoll(_value.buffer.c_str(), (char**)0, 10);
+  }
+  return _jsont_parse_int((const char*)_scan.bytes + _scan.value_offset,
+                          _scan.value_length, valueTerminated());
+}
 
-  const char* bytes;
 
-  if (_value.buffered) {
-    // edge-case since only happens with string values using escape sequences
-    bytes = _value.buffer.c_str();
-  } else {
-    bytes = (const char*)_input.bytes + _value.offset;
-    if (availableInput() == 0) {
-      // In this case where the data lies at the edge of the buffer, we can't pass
-      // it directly to atof, since there will be no sentinel byte. We are fine
-      // with a copy, since this is an edge case (only happens either for broken
-      // JSON or when the whole document is just a number).
-      char* buf[21];
-      if (_value.length > 20) {
-        // We are unable to interpret such a large literal in this edge-case
-        return 0;
-      }
-      memcpy((void*)buf, (const void*)bytes, _value.length);
-      buf[_value.length] = '\0';
-      return strtoll((const char*)buf, (char**)0, 10);
+JSONT_INLINE TokenRecord Tokenizer::record() const {
+  TokenRecord r;
+  r.token = _token;
+  r.flags = 0;
+  if (hasValue()) {
+    r.offset = _scan.value_offset;
+    r.length = _scan.value_length;
+    if (_scan.value_escaped) {
+      r.flags = TokenRecord::Escaped;
     }
+  } else if (_token == End || _token == Error) {
+    r.offset = _scan.offset;
+    r.length = 0;
+  } else {
+    r.offset = _scan.start;
+    r.length = _scan.offset - _scan.start;
   }
-
-  return strtoll(bytes, (char**)0, 10);
+  return r;
 }
 
 
-const Token& Tokenizer::next() {
-  //
-  // { } [ ] n t f "
-  //         | | | |
-  //         | | | +- /[^"]*/ "
-  //         | | +- a l s e
-  //         | +- r u e
-  //         +- u l l
-  //
-  while (!endOfInput()) {
-    uint8_t b = _input.bytes[_input.offset++];
-    switch (b) {
-      case '{': return setToken(ObjectStart);
-      case '}': {
-        if (_token == _Comma) { return setError(UnexpectedTrailingComma); }
-        return setToken(ObjectEnd);
-      }
+JSONT_INLINE size_t Tokenizer::nextBatch(TokenRecord* records, size_t max) {
+  size_t n = 0;
+  while (n != max) {
+    Token token = next();
+    records[n++] = record();
+    if (token == End || token == Error) {
+      break;
+    }
+  }
+  return n;
+}
 
-      case '[': return setToken(ArrayStart);
-      case ']': {
-        if (_token == _Comma) { return setError(UnexpectedTrailingComma); }
-        return setToken(ArrayEnd);
-      }
 
-      case 'n':
-        return TokenizerInternal::readAtom(*this, "ull", 3, jsont::Null);
-      case 't':
-        return TokenizerInternal::readAtom(*this, "rue", 3, jsont::True);
-      case 'f':
-        return TokenizerInternal::readAtom(*this, "alse", 4, jsont::False);
+JSONT_INLINE void Tokenizer::assignTo(const TokenRecord& record, std::string& str) const {
+  const uint8_t* p = _scan.bytes + record.offset;
+  if (record.flags & TokenRecord::Escaped) {
+    str.resize(record.length);
+    str.resize(_jsont_unescape(p, p + record.length, (uint8_t*)&str[0]));
+  } else {
+    str.assign((const char*)p, record.length);
+  }
+}
 
-      case ' ': case '\t': case '\r': case '\n': // IETF RFC4627
-        // ignore whitespace and let the outer "while" do its thing
-        break;
 
-      case 0:
-        return setError(InvalidByte);
-
-      // when we read a value, we don't produce a token until we either reach
-      // end of input, a colon (then the value is a field name), a comma, or an
-      // array or object terminator.
-
-      case '"': {
-        _value.beginAtOffset(_input.offset);
-
-        while (!endOfInput()) {
-          b = _input.bytes[_input.offset++];
-          assert(_input.offset < _input.length);
-          
-          switch (b) {
-
-            case '\\': {
-              // We must go buffered since the input segment != value
-              if (!_value.buffered) {
-                _value.buffered = true;
-                _value.buffer.assign(
-                  (const char*)(_input.bytes+_value.offset),
-                  _input.offset - _value.offset - 1
-                );
-              }
-
-              if (endOfInput()) {
-                return setError(PrematureEndOfInput);
-              }
-              
-              b = _input.bytes[_input.offset++];
-              switch (b) {
-                case 'b': _value.buffer.append(1, '\x08'); break;
-                case 'f': _value.buffer.append(1, '\x0C'); break;
-                case 'n': _value.buffer.append(1, '\x0A'); break;
-                case 'r': _value.buffer.append(1, '\x0D'); break;
-                case 't': _value.buffer.append(1, '\x09'); break;
-                case 'u': {
-                  // \uxxxx
-                  if (availableInput() < 4) {
-                    return setError(PrematureEndOfInput);
-                  }
-
-                  uint64_t utf16cp =
-                    _xtou64(TokenizerInternal::currentInput(*this), 4);
-                  _input.offset += 4;
-
-                  if (utf16cp > 0xffff) {
-                    return setError(MalformedUnicodeEscapeSequence);
-                  }
-
-                  uint16_t cp = (uint16_t)(0xffff & utf16cp);
-
-                  // Append UTF-8 byte(s) representing the Unicode codepoint cp
-                  if (cp < 0x80) {
-                    // U+0000 - U+007F
-                    uint8_t cp8 = ((uint8_t)cp);
-                    _value.buffer.append(1, (char)cp8);
-                  } else if (cp < 0x800) {
-                    // U+0080 - U+07FF
-                    uint8_t cp8 = (uint8_t)((cp >> 6) | 0xc0);
-                    _value.buffer.append(1, (char)cp8);
-                    cp8 = (uint8_t)((cp & 0x3f) | 0x80);
-                    _value.buffer.append(1, (char)cp8);
-                  } else if (cp >= 0xD800u && cp <= 0xDFFFu) {
-                    // UTF-16 Surrogate pairs -- according to the UTF-8
-                    // definition (RFC 3629) the high and low surrogate halves
-                    // used by UTF-16 (U+D800 through U+DFFF) are not legal
-                    // Unicode values, and the UTF-8 encoding of them is an
-                    // invalid byte sequence. Instead of throwing an error, we
-                    // substitute this character with the replacement character
-                    // U+FFFD (UTF-8: EF,BF,BD).
-                    _value.buffer.append("\xEF\xBF\xBD");
-                    // 
-                  } else {
-                    // U+0800 - U+FFFF
-                    uint8_t cp8 = (uint8_t)((cp >> 12) | 0xe0);
-                    _value.buffer.append(1, (char)cp8);
-                    cp8 = (uint8_t)(((cp >> 6) & 0x3f) | 0x80);
-                    _value.buffer.append(1, (char)cp8);
-                    cp8 = (uint8_t)((cp & 0x3f) | 0x80);
-                    _value.buffer.append(1, (char)cp8);
-                  }
-
-                  break;
-                }
-                default:
-                  _value.buffer.append(1, (char)b); break;
-              }
-              break;
-            }
-
-            case '"':
-              goto after_initial_read_b;
-
-            case 0:
-              return setError(InvalidByte);
-
-            default: {
-              if (_value.buffered) {
-                // TODO: Make this efficient by appending chunks between
-                // boundaries instead of appending per-byte
-                _value.buffer.append(1, (char)b);
-              }
-              break;
-            }
-          } // switch(b)
-        } // while (!endOfInput())
-
-        after_initial_read_b:
-        if (b != '"') {
-          return setError(UnterminatedString);
-        }
+JSONT_INLINE double Tokenizer::floatValue(const TokenRecord& record) const {
+  if (record.token < Integer || record.token > FieldName) {
+    return record.token == jsont::True ? 1.0 : 0.0;
+  }
+  if (record.flags & TokenRecord::Escaped) {
+    std::string str;
+    assignTo(record, str);
+    return strtod(str.c_str(), (char**)0);
+  }
+  return _jsont_parse_float((const char*)_scan.bytes + record.offset,
+                            record.length,
+                            record.offset + record.length != _scan.length ||
+                            _scan.padded);
+}
 
-        if (!_value.buffered) {
-          _value.length = _input.offset - _value.offset - 1;
-        }
 
-        // is this a field name?
-        while (!endOfInput()) {
-          b = _input.bytes[_input.offset++];
-          switch (b) {
-            case ' ': case '\t': case '\r': case '\n': break;
-            case ':': return setToken(FieldName);
-            case ',': goto string_read_return_string;
-            case ']': case '}': {
-              --_input.offset; // rewind
-              goto string_read_return_string;
-            }
-            case 0: return setError(InvalidByte);
-            default: {
-              // Expected a comma or a colon
-              return setError(SyntaxError);
-            }
-          }
-        }
+JSONT_INLINE int64_t Tokenizer::intValue(const TokenRecord& record) const {
+  if (record.token < Integer || record.token > FieldName) {
+    return record.token == jsont::True ? 1LL : 0LL;
+  }
+  if (record.flags & TokenRecord::Escaped) {
+    std::string str;
+    assignTo(record, str);
+    return strtoll(str.c_str(), (char**)0, 10);
+  }
+  return _jsont_parse_int((const char*)_scan.bytes + record.offset,
+                          record.length,
+                          record.offset + record.length != _scan.length ||
+                          _scan.padded);
+}
 
-        string_read_return_string:
-        return setToken(jsont::String);
-      }
 
-      case ',': {
-        if (_token == ObjectStart || _token == ArrayStart || _token == _Comma) {
-          return setError(UnexpectedComma);
-        }
-        _token = _Comma;
-        break;
-      }
+// Both are thin wrappers around the scanners in jsont_scan_next.h and
+// jsont_kernels.h, which are shared with the C tokenizer.
+JSONT_INLINE const Token& Tokenizer::next() {
+  _value.buffered = false;
+  _jsont_scan_t* s = &_scan;
+  #define _JSONT_SCAN_RETURN(token) return _token = _token_of(token)
+  #include "jsont_scan_next.h"
+  #undef _JSONT_SCAN_RETURN
+}
 
-      default: {
-        if (isdigit((int)b) || b == '+' || b == '-') {
-          // We are reading a number
-          _value.beginAtOffset(_input.offset-1);
-          Token token = jsont::Integer;
-
-          while (!endOfInput()) {
-            b = _input.bytes[_input.offset++];
-            switch (b) {
-              case '0'...'9': break;
-              case '.': token = jsont::Float; break;
-              case 'E': case 'e': case '-': case '+': {
-                if (token != jsont::Float) {
-                  return setError(MalformedNumberLiteral);
-                }
-                break;
-              }
-              default: {
-                if ( (_input.offset - _value.offset == 1) &&
-                     (_input.bytes[_value.offset] == '-' || 
-                      _input.bytes[_value.offset] == '+') ) {
-                  return setError(MalformedNumberLiteral);
-                }
-
-                // rewind the byte that terminated this number literal
-                --_input.offset;
-
-                _value.length = _input.offset - _value.offset - 1;
-                return setToken(token);
-              }
-            }
-          }
-          return setToken(End);
-        } else {
-          return setError(InvalidByte);
-        }
-      }
-    }
-  }
 
-  return setToken(End);
+JSONT_INLINE const Token& Tokenizer::nextTrusted() {
+  _value.buffered = false;
+  return _token = _token_of(_jsont_scan_next_trusted(&_scan));
 }
 
 
-enum {
-  kUTF8ByteVerbatim = 0,
-  kUTF8ByteEncode1, // "\u000x"
-  kUTF8ByteEncode2, // "\u00xx"
-};
-#define V kUTF8ByteVerbatim
-#define E1 kUTF8ByteEncode1
-#define E2 kUTF8ByteEncode2
-static const uint8_t kUTF8ByteTable[256] = {
-  E1, E1, E1, E1, E1, E1, E1, E1, 'b', 't', 'n', E1, 'f', 'r', E1, E1, E2, E2,
-  E2, E2, E2, E2, E2, E2, E2, E2, E2, E2, E2, E2, E2, E2, V, V, '"', V, V, V, V,
-  V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
-  V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
-  V, '\\', V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
-  V, V, V, V, V, V, V, V, V, V, V, E2, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
-  V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
-  V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
-  V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
-  V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
-  V, V, V, V, V, V, V, V, V, V
-};
-#undef V
-#undef E1
-#undef E2
-
 // #ifndef __has_feature
 //   #define __has_feature(x) 0
 // #endif
@@ -456,106 +328,999 @@ static const uint8_t kUTF8ByteTable[256] = {
 //   #define JSONT_CONST_ASSERT(expr, error_msg) ((void)0)
 // #endif
 
-Builder& Builder::appendString(const uint8_t* v, size_t length, TextEncoding encoding) {
+
+JSONT_INLINE Builder& Builder::setASCIIOnly(bool asciiOnly) {
+  _asciiOnly = asciiOnly;
+  return *this;
+}
+
+JSONT_INLINE Builder& Builder::setUTF8Validation(UTF8Validation validation) {
+  _utf8Validation = validation;
+  return *this;
+}
+
+JSONT_INLINE Builder& Builder::appendString(const uint8_t* v, size_t length, TextEncoding encoding) {
   reserve(length + 2);
   _buf[_size++] = '"';
 
   assert(encoding == UTF8TextEncoding /* Currently only UTF-8 is supported */);
 
+  // Non-ASCII bytes take the slow path when they need to be checked
+  const bool inspectNonASCII = _asciiOnly || _utf8Validation != TrustUTF8;
+
   const uint8_t* end = v+length;
   while (v != end) {
-    uint8_t s = kUTF8ByteTable[*v];
-    switch (s) {
-      case kUTF8ByteVerbatim:
-        _buf[_size++] = *v;
-        break;
-      case kUTF8ByteEncode1: {
-        assert(*v < 16);
-        size_t remainingSize = end-v+1+5; // five additional bytes needed
-        reserve(remainingSize);
-        _buf[_size] = '\\';
-        _buf[++_size] = 'u';
-        _buf[++_size] = '0';
-        _buf[++_size] = '0';
-        _buf[++_size] = '0';
-        _buf[++_size] = *v + (*v > 10 ? 55 : 48); // A-F : 0-9
-        ++_size;
-        assert(_size <= _capacity);
+    // Copy any run of bytes which need no escaping in one go
+    const uint8_t* run = _jsont_find_escape(v, end, inspectNonASCII);
+    if (run != v) {
+      memcpy((void*)(_buf+_size), (const void*)v, run - v);
+      _size += run - v;
+      v = run;
+      if (v == end) {
         break;
       }
-      case kUTF8ByteEncode2: {
-        // Note: *v is guaranteed to be within the set [16,32),127. This is
-        // an affect of the kUTF8ByteTable lookup table and this code needs to
-        // be revised if the lookup table adds or removes any kUTF8ByteEncode.
-        assert((*v > 15 && *v < 32) || *v == 127);
-        size_t remainingSize = end-v+1+5; // five additional bytes needed
-        reserve(remainingSize);
-        _buf[_size] = '\\';
-        _buf[++_size] = 'u';
-        _buf[++_size] = '0';
-        _buf[++_size] = '0';
-        uint8_t b1 = (*v & 0xf0) / 16;
-        //uint8_t b1 = (*v & 0xf0) >> 4; // slightly faster but LE-specific
-        uint8_t b2 = *v & 0x0f;
-        _buf[++_size] = b1 + (b1 > 10 ? 55 : 48); // A-F : 0-9
-        _buf[++_size] = b2 + (b2 > 10 ? 55 : 48); // A-F : 0-9
-        ++_size;
-        assert(_size <= _capacity);
+    }
+
+    if (*v >= 0x80) {
+      // Non-ASCII in ASCII-only or validating mode
+      uint32_t cp;
+      size_t n = _jsont_decode_utf8(v, end, &cp);
+      if (n == 0) {
+        if (_utf8Validation == RejectInvalidUTF8) {
+          throw std::invalid_argument("jsont::Builder: invalid UTF-8 in string");
+        }
+        cp = 0xFFFDu;
+        n = 1;
+        if (!_asciiOnly) {
+          // U+FFFD is three bytes in UTF-8
+          ++v;
+          reserve((end-v) + 3 + 1);
+          memcpy((void*)(_buf+_size), (const void*)"\xEF\xBF\xBD", 3);
+          _size += 3;
+          continue;
+        }
+      } else if (!_asciiOnly) {
+        // Valid UTF-8
+        memcpy((void*)(_buf+_size), (const void*)v, n);
+        _size += n;
+        v += n;
+        continue;
+      }
+
+      // Encode the codepoint as "\uXXXX", or as a surrogate pair if outside
+      // the BMP
+      v += n;
+      reserve((end-v) + 12 + 1);
+      if (cp >= 0x10000u) {
+        cp -= 0x10000u;
+        _jsont_write_unicode_escape(_buf+_size, 0xD800u + (cp >> 10));
+        _jsont_write_unicode_escape(_buf+_size+6, 0xDC00u + (cp & 0x3ff));
+        _size += 12;
+      } else {
+        _jsont_write_unicode_escape(_buf+_size, cp);
+        _size += 6;
+      }
+      assert(_size <= _capacity);
+      continue;
+    }
+
+    // Control character, quote or reverse solidus. Room is needed for the
+    // escape sequence plus the rest of the input and the terminating quote.
+    reserve((end-v) + 6);
+    _size += _jsont_escape_ascii(_buf+_size, *v);
+    assert(_size <= _capacity);
+    ++v;
+  }
+
+  _buf[_size++] = '"';
+  assert(_size <= _capacity);
+  return *this;
+}
+
+// Returns true if [v,end) is validly escaped JSON string content
+inline bool _is_escaped(const uint8_t* v, const uint8_t* end) {
+  while (v != end) {
+    v = _jsont_find_escape(v, end, false);
+    if (v == end) {
+      break;
+    }
+    uint8_t b = *v++;
+    if (b == 0x7f) {
+      continue; // DEL doesn't need escaping, but is escaped by Builder
+    }
+    if (b != '\\' || v == end) {
+      return false;
+    }
+    switch (*v++) {
+      case '"': case '\\': case '/':
+      case 'b': case 'f': case 'n': case 'r': case 't':
+        break;
+      case 'u': {
+        if (end - v < 4 || _jsont_hex16(v) < 0) {
+          return false;
+        }
+        v += 4;
         break;
       }
       default:
-        // reverse solidus escape
-        size_t remainingSize = end-v+1+1; // one additional byte needed
-        reserve(remainingSize);
-        _buf[_size++] = '\\';
-        _buf[_size++] = s;
-        assert(_size <= _capacity);
-        break;
+        return false;
     }
+  }
+  return true;
+}
 
-    ++v;
+JSONT_INLINE void Builder::checkEscaped(const char* v, size_t length) {
+  if (!_is_escaped((const uint8_t*)v, (const uint8_t*)v + length)) {
+    throw std::invalid_argument("jsont::Builder: malformed escaped string");
   }
+}
 
+JSONT_INLINE Builder& Builder::appendEscapedString(const char* v, size_t length) {
+  reserve(length + 2);
+  _buf[_size++] = '"';
+  memcpy((void*)(_buf+_size), (const void*)v, length);
+  _size += length;
   _buf[_size++] = '"';
+  return *this;
+}
+
+// Returns true if any of `length` bytes at `v` is not ASCII
+inline bool _has_non_ascii(const char* v, size_t length) {
+  for (const char* end = v + length; v != end; ++v) {
+    if ((uint8_t)*v >= 0x80) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Appends `length` bytes of escaped JSON at `v` to `out`, writing non-ASCII
+// characters as "\uXXXX" escape sequences as Builder does in ASCII-only mode
+inline void _append_ascii_only(std::string& out, const char* v, size_t length) {
+  const uint8_t* p = (const uint8_t*)v;
+  const uint8_t* end = p + length;
+  while (p != end) {
+    const uint8_t* run = p;
+    while (run != end && *run < 0x80) {
+      ++run;
+    }
+    out.append((const char*)p, run - p);
+    if (run == end) {
+      break;
+    }
+    uint32_t cp;
+    size_t n = _jsont_decode_utf8(run, end, &cp);
+    if (n == 0) {
+      cp = 0xFFFDu;
+      n = 1;
+    }
+    char buf[12];
+    if (cp >= 0x10000u) {
+      cp -= 0x10000u;
+      _jsont_write_unicode_escape(buf, 0xD800u + (cp >> 10));
+      _jsont_write_unicode_escape(buf + 6, 0xDC00u + (cp & 0x3ff));
+      out.append(buf, 12);
+    } else {
+      _jsont_write_unicode_escape(buf, cp);
+      out.append(buf, 6);
+    }
+    p = run + n;
+  }
+}
+
+JSONT_INLINE void Key::init(const char* name, size_t length, TextEncoding e) {
+  Builder b;
+  b.value(name, length, e);
+  _bytes.reserve(b.size() + 1);
+  _bytes.assign(b.bytes(), b.size());
+  _bytes.append(1, ':');
+  if (_has_non_ascii(_bytes.data(), _bytes.size())) {
+    _append_ascii_only(_asciiBytes, _bytes.data(), _bytes.size());
+  }
+}
+
+
+inline size_t _format_number(char* dst, long long v) {
+  return _jsont_format_int64(dst, v);
+}
+
+inline size_t _format_number(char* dst, long v) {
+  return _jsont_format_int64(dst, v);
+}
+
+inline size_t _format_number(char* dst, int v) {
+  return _jsont_format_int64(dst, v);
+}
+
+inline size_t _format_number(char* dst, unsigned int v) {
+  return _jsont_format_int64(dst, v);
+}
+
+inline size_t _format_number(char* dst, unsigned long long v) {
+  return _jsont_format_uint64(dst, v);
+}
+
+inline size_t _format_number(char* dst, unsigned long v) {
+  return _jsont_format_uint64(dst, v);
+}
+
+inline size_t _format_number(char* dst, double v) {
+  // Note: writes a sentinel byte after the number
+  return snprintf(dst, _JSONT_DOUBLE_MAX_LENGTH + 1, "%g", v);
+}
+
+// Integers of any width, signed or not, take at most as many bytes as INT64_MIN
+template <typename T> inline size_t _max_number_length(T) {
+  return _JSONT_INT64_MAX_LENGTH;
+}
+template <> inline size_t _max_number_length(double) {
+  return _JSONT_DOUBLE_MAX_LENGTH;
+}
+
+JSONT_INLINE Builder& Builder::value(double v) {
+  prefix();
+  // Formatted on the stack so that only the actual length is reserved
+  char buf[_JSONT_DOUBLE_MAX_LENGTH + 1];
+  size_t z = _format_number(buf, v);
+  _state = AfterValue;
+  return appendBytes(buf, z);
+}
+
+JSONT_INLINE Builder& Builder::value(long long v) {
+  prefix();
+  char buf[_JSONT_INT64_MAX_LENGTH];
+  size_t z = _jsont_format_int64(buf, v);
+  _state = AfterValue;
+  return appendBytes(buf, z);
+}
+
+JSONT_INLINE Builder& Builder::value(unsigned long long v) {
+  prefix();
+  char buf[_JSONT_INT64_MAX_LENGTH];
+  size_t z = _jsont_format_uint64(buf, v);
+  _state = AfterValue;
+  return appendBytes(buf, z);
+}
+
+JSONT_INLINE Template::Renderer& Template::Renderer::value(double v) {
+  char buf[_JSONT_DOUBLE_MAX_LENGTH + 1];
+  return fill(buf, _format_number(buf, v));
+}
+
+JSONT_INLINE Template::Renderer& Template::Renderer::value(long long v) {
+  char buf[_JSONT_INT64_MAX_LENGTH];
+  return fill(buf, _jsont_format_int64(buf, v));
+}
+
+JSONT_INLINE Template::Renderer& Template::Renderer::value(unsigned long long v) {
+  char buf[_JSONT_INT64_MAX_LENGTH];
+  return fill(buf, _jsont_format_uint64(buf, v));
+}
+
+JSONT_INLINE UncheckedAppender& UncheckedAppender::value(double v) {
+  prefix();
+  _state = Builder::AfterValue;
+  char buf[_JSONT_DOUBLE_MAX_LENGTH + 1];
+  put(buf, _format_number(buf, v));
+  return *this;
+}
+
+JSONT_INLINE UncheckedAppender& UncheckedAppender::value(long long v) {
+  prefix();
+  _state = Builder::AfterValue;
+  char buf[_JSONT_INT64_MAX_LENGTH];
+  put(buf, _jsont_format_int64(buf, v));
+  return *this;
+}
+
+JSONT_INLINE UncheckedAppender& UncheckedAppender::value(unsigned long long v) {
+  prefix();
+  _state = Builder::AfterValue;
+  char buf[_JSONT_INT64_MAX_LENGTH];
+  put(buf, _jsont_format_uint64(buf, v));
+  return *this;
+}
+
+JSONT_INLINE UncheckedAppender& UncheckedAppender::value(const char* v, size_t length) {
+  prefix();
+  _state = Builder::AfterValue;
+  const uint8_t* p = (const uint8_t*)v;
+  const uint8_t* end = p + length;
+  put('"');
+  while (p != end) {
+    const uint8_t* run = _jsont_find_escape(p, end, false);
+    put((const char*)p, run - p);
+    if (run == end) {
+      break;
+    }
+    assert(available() >= 6);
+    _cursor += _jsont_escape_ascii(_cursor, *run);
+    p = run + 1;
+  }
+  put('"');
+  return *this;
+}
+
+// Number of values to reserve space for at a time in `appendValues`
+#define _JSONT_VALUES_BLOCK_SIZE 256
+
+template <typename T>
+Builder& Builder::appendValues(const T* v, size_t count) {
+  if (count == 0) {
+    return *this;
+  }
+  const T* end = v + count;
+  if (_indentWidth != 0) {
+    while (v != end) { value(*v++); }
+    return *this;
+  }
+
+  // The first value takes care of any separator and the state. The rest are
+  // written a block at a time, each preceded by a comma.
+  value(*v++);
+  const size_t maxz = 1 + _max_number_length(T());
+  while (v != end) {
+    size_t n = end - v;
+    if (n > _JSONT_VALUES_BLOCK_SIZE) {
+      n = _JSONT_VALUES_BLOCK_SIZE;
+    }
+    size_t z = (n * maxz) + 1; // +1 for a possible sentinel
+    if (available() < z && _storage == ExternalStorage) {
+      // Don't report overflow near the end of caller-provided storage when
+      // the actual output might still fit
+      while (n--) { value(*v++); }
+      continue;
+    }
+    reserve(z);
+    char* p = _buf + _size;
+    for (const T* blockEnd = v + n; v != blockEnd; ++v) {
+      *p++ = ',';
+      p += _format_number(p, *v);
+    }
+    _size = p - _buf;
+    assert(_size <= _capacity);
+  }
+  return *this;
+}
+
+JSONT_INLINE Builder& Builder::values(const double* v, size_t count) {
+  return appendValues(v, count);
+}
+
+JSONT_INLINE Builder& Builder::values(const long long* v, size_t count) {
+  return appendValues(v, count);
+}
+
+JSONT_INLINE Builder& Builder::values(const int* v, size_t count) {
+  return appendValues(v, count);
+}
+
+JSONT_INLINE Builder& Builder::values(const unsigned int* v, size_t count) {
+  return appendValues(v, count);
+}
+
+JSONT_INLINE Builder& Builder::values(const long* v, size_t count) {
+  return appendValues(v, count);
+}
+
+JSONT_INLINE Builder& Builder::values(const unsigned long long* v,
+                                      size_t count) {
+  return appendValues(v, count);
+}
+
+JSONT_INLINE Builder& Builder::values(const unsigned long* v, size_t count) {
+  return appendValues(v, count);
+}
+
+JSONT_INLINE Builder& Builder::value(const ArrayChunks& array) {
+  prefix();
+  reserve(array.size());
+  _buf[_size++] = '[';
+  bool first = true;
+  for (size_t i = 0; i != array.count(); ++i) {
+    const Builder& b = array.chunk(i);
+    if (b.size() == 0) {
+      continue;
+    }
+    if (!first) {
+      _buf[_size++] = ',';
+    }
+    first = false;
+    memcpy((void*)(_buf+_size), (const void*)b.bytes(), b.size());
+    _size += b.size();
+  }
+  _buf[_size++] = ']';
   assert(_size <= _capacity);
+  _state = AfterValue;
   return *this;
 }
 
+JSONT_INLINE size_t ArrayChunks::size() const {
+  size_t z = 2, nonEmpty = 0;
+  for (size_t i = 0; i != _chunks.size(); ++i) {
+    if (_chunks[i].size() != 0) {
+      z += _chunks[i].size();
+      ++nonEmpty;
+    }
+  }
+  return (nonEmpty == 0) ? z : z + nonEmpty - 1; // commas
+}
+
+JSONT_INLINE size_t ArrayChunks::iovecCount() const {
+  size_t nonEmpty = 0;
+  for (size_t i = 0; i != _chunks.size(); ++i) {
+    if (_chunks[i].size() != 0) {
+      ++nonEmpty;
+    }
+  }
+  return (nonEmpty == 0) ? 2 : 2 + (nonEmpty * 2) - 1;
+}
+
+// Number of indentation levels to precompute when enabling pretty-printing.
+// Deeper levels grow the indentation run on demand.
+#define _JSONT_INDENT_LEVELS 8
+
+JSONT_INLINE Builder& Builder::setIndentation(Indentation style, size_t width) {
+  if (style == NoIndentation || width == 0) {
+    _indentWidth = 0;
+    _indent.clear();
+  } else {
+    _indentWidth = width;
+    _indent.assign(1, '\n');
+    _indent.append(width * _JSONT_INDENT_LEVELS,
+                   style == TabIndentation ? '\t' : ' ');
+  }
+  return *this;
+}
+
+JSONT_INLINE void Builder::prettyPrefix() {
+  switch (_state) {
+    case AfterFieldName:
+      reserve(2);
+      _buf[_size++] = ':';
+      _buf[_size++] = ' ';
+      break;
+    case AfterValue:
+      appendChar(',');
+      appendNewline();
+      break;
+    case AfterObjectStart:
+    case AfterArrayStart:
+      appendNewline();
+      break;
+    default:
+      break;
+  }
+}
+
+JSONT_INLINE void Builder::appendNewline() {
+  // A newline followed by the indentation of the current nesting level, copied
+  // from the precomputed indentation run
+  size_t z = 1 + (_depth * _indentWidth);
+  if (_indent.size() < z) {
+    _indent.append(z - _indent.size() + (_indentWidth * _JSONT_INDENT_LEVELS),
+                   _indent[1]);
+  }
+  reserve(z);
+  memcpy((void*)(_buf+_size), (const void*)_indent.data(), z);
+  _size += z;
+}
+
+JSONT_INLINE void Builder::grow(size_t size) {
+  // Slow path of `reserve` for anything but MallocStorage
+  if (_storage == ExternalStorage && _overflow == ThrowOnOverflow) {
+    throw std::length_error("jsont::Builder: output exceeds buffer capacity");
+  }
+  size_t capacity = _capacity + (size - available());
+  capacity = (capacity < 64) ? 64 : (capacity * 1.5);
+  switch (_storage) {
+    case ExternalStorage: {
+      // Caller-provided storage is full. Move to a heap buffer.
+      char* buf = (char*)malloc(capacity);
+      if (buf == 0) {
+        throw std::bad_alloc();
+      }
+      memcpy((void*)buf, (const void*)_buf, _size);
+      _buf = buf;
+      _storage = MallocStorage;
+      break;
+    }
+    case StringStorage: {
+      // Make use of any extra capacity the string has allocated
+      _str.resize(capacity);
+      if (_str.capacity() > capacity) {
+        capacity = _str.capacity();
+        _str.resize(capacity);
+      }
+      break;
+    }
+    case VectorStorage: {
+      _vec.resize(capacity);
+      break;
+    }
+    default: assert(!"unexpected storage"); break;
+  }
+  _capacity = capacity;
+  attachContainer();
+}
+
+JSONT_INLINE void Builder::attachContainer() {
+  // Point _buf at the contents of a std::string or std::vector backing buffer
+  if (_storage == StringStorage) {
+    _buf = (_capacity == 0) ? 0 : &_str[0];
+  } else if (_storage == VectorStorage) {
+    _buf = (_capacity == 0) ? 0 : &_vec[0];
+  }
+}
+
+JSONT_INLINE std::string Builder::takeString() {
+  std::string s;
+  if (_storage == StringStorage) {
+    _str.resize(_size);
+    s.swap(_str);
+    _buf = 0;
+    _capacity = 0;
+  } else {
+    s.assign(_buf, _size);
+  }
+  reset();
+  return s;
+}
+
+JSONT_INLINE std::vector<char> Builder::takeVector() {
+  std::vector<char> v;
+  if (_storage == VectorStorage) {
+    _vec.resize(_size);
+    v.swap(_vec);
+    _buf = 0;
+    _capacity = 0;
+  } else {
+    v.assign(_buf, _buf + _size);
+  }
+  reset();
+  return v;
+}
+
+JSONT_INLINE SharedBytes Builder::share() {
+  size_t size;
+  char* bytes = (char*)seizeBytes(size);
+  return SharedBytes(bytes, size);
+}
+
+JSONT_INLINE SharedBytes::SharedBytes(char* bytes, size_t size) {
+  _block = new Block;
+  _block->refs = 1;
+  _block->size = size;
+  _block->bytes = bytes;
+}
+
+JSONT_INLINE void SharedBytes::release() {
+  if (!_block) { return; }
+#if JSONT_CXX_ATOMIC
+  bool last = _block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1;
+#elif defined(_MSC_VER)
+  bool last = _InterlockedDecrement(&_block->refs) == 0;
+#else
+  bool last = __sync_sub_and_fetch(&_block->refs, 1) == 0;
+#endif
+  if (last) {
+    free((void*)_block->bytes);
+    delete _block;
+  }
+  _block = 0;
+}
+
 #if JSONT_CXX_RVALUE_REFS
   // Move constructor and assignment operator
-  Builder::Builder(Builder&& other)
+  JSONT_INLINE Builder::Builder(Builder&& other)
       : _buf(other._buf)
       , _capacity(other._capacity)
       , _size(other._size)
-      , _state(other._state) {
+      , _state(other._state)
+      , _depth(other._depth)
+      , _indentWidth(other._indentWidth)
+      , _indent(std::move(other._indent))
+      , _storage(other._storage)
+      , _overflow(other._overflow)
+      , _asciiOnly(other._asciiOnly)
+      , _utf8Validation(other._utf8Validation)
+      , _str(std::move(other._str))
+      , _vec(std::move(other._vec)) {
     other._buf = 0;
+    attachContainer();
   }
 
-  Builder& Builder::operator=(Builder&& other) {
+  JSONT_INLINE Builder& Builder::operator=(Builder&& other) {
+    if (this == &other) {
+      return *this;
+    }
+    if (_storage == MallocStorage) {
+      free((void*)_buf);
+    }
     _buf = other._buf; other._buf = 0;
     _capacity = other._capacity;
     _size = other._size;
     _state = other._state;
+    _depth = other._depth;
+    _indentWidth = other._indentWidth;
+    _indent = std::move(other._indent);
+    _storage = other._storage;
+    _overflow = other._overflow;
+    _asciiOnly = other._asciiOnly;
+    _utf8Validation = other._utf8Validation;
+    _str = std::move(other._str);
+    _vec = std::move(other._vec);
+    attachContainer();
     return *this;
   }
 #endif
 
-Builder::Builder(const Builder& other)
+// Returns a malloc'ed copy of `size` bytes at `bytes`, with room for
+// `capacity`. Throws std::bad_alloc if out of memory.
+inline char* _copy_bytes(const char* bytes, size_t size, size_t capacity) {
+  if (capacity == 0) {
+    return 0;
+  }
+  char* buf = (char*)malloc(capacity);
+  if (buf == 0) {
+    throw std::bad_alloc();
+  }
+  memcpy((void*)buf, (const void*)bytes, size);
+  return buf;
+}
+
+JSONT_INLINE Builder::Builder(const Builder& other)
     : _buf(0)
     , _capacity(other._capacity)
     , _size(other._size)
-    , _state(other._state) {
-  _buf = (char*)malloc(_capacity);
-  memcpy((void*)_buf, (const void*)other._buf, _size);
+    , _state(other._state)
+    , _depth(other._depth)
+    , _indentWidth(other._indentWidth)
+    , _indent(other._indent)
+    , _storage(other._storage == ExternalStorage ? MallocStorage
+                                                 : other._storage)
+    , _overflow(other._overflow)
+    , _asciiOnly(other._asciiOnly)
+    , _utf8Validation(other._utf8Validation)
+    , _str(other._str)
+    , _vec(other._vec) {
+  if (_storage == MallocStorage) {
+    _buf = _copy_bytes(other._buf, _size, _capacity);
+  } else {
+    attachContainer();
+  }
 }
 
-Builder& Builder::operator=(const Builder& other) {
+JSONT_INLINE Builder& Builder::operator=(const Builder& other) {
+  if (this == &other) {
+    return *this;
+  }
+  // Copied first, so that the builder is unchanged if that throws
+  char* buf = (other._storage == StringStorage ||
+               other._storage == VectorStorage)
+            ? 0 : _copy_bytes(other._buf, other._size, other._capacity);
+  if (_storage == MallocStorage) {
+    free((void*)_buf);
+  }
+  _buf = buf;
   _capacity = other._capacity;
   _size = other._size;
   _state = other._state;
-  _buf = (char*)malloc(_capacity);
-  memcpy((void*)_buf, (const void*)other._buf, _size);
+  _depth = other._depth;
+  _indentWidth = other._indentWidth;
+  _indent = other._indent;
+  _storage = (other._storage == ExternalStorage) ? MallocStorage
+                                                 : other._storage;
+  _overflow = other._overflow;
+  _asciiOnly = other._asciiOnly;
+  _utf8Validation = other._utf8Validation;
+  _str = other._str;
+  _vec = other._vec;
+  attachContainer();
   return *this;
 }
 
+// Canonicalizer
+
+inline void _append_canonical_string(std::string& out, const char* v,
+                                     size_t length) {
+  static const char kHex[] = "0123456789abcdef";
+  out.append(1, '"');
+  const char* end = v + length;
+  const char* run = v; // start of bytes to copy verbatim
+  for (; v != end; ++v) {
+    uint8_t b = (uint8_t)*v;
+    if (b >= 0x20 && b != '"' && b != '\\') {
+      continue;
+    }
+    out.append(run, v - run);
+    run = v + 1;
+    char esc[6] = {'\\', 0, '0', '0', 0, 0};
+    switch (b) {
+      case '"': case '\\': esc[1] = (char)b; break;
+      case '\b': esc[1] = 'b'; break;
+      case '\f': esc[1] = 'f'; break;
+      case '\n': esc[1] = 'n'; break;
+      case '\r': esc[1] = 'r'; break;
+      case '\t': esc[1] = 't'; break;
+      default: {
+        esc[1] = 'u';
+        esc[4] = kHex[b >> 4];
+        esc[5] = kHex[b & 0xf];
+        out.append(esc, 6);
+        continue;
+      }
+    }
+    out.append(esc, 2);
+  }
+  out.append(run, end - run);
+  out.append(1, '"');
+}
+
+inline bool _append_canonical_number(std::string& out, double v) {
+  // ECMAScript Number.prototype.toString, as required by RFC 8785
+  if (isnan(v) || isinf(v)) {
+    return false;
+  }
+  if (v == 0.0) {
+    out.append(1, '0'); // also for -0
+    return true;
+  }
+
+  // Find the shortest representation which reads back as the same number
+  char buf[32];
+  for (int precision = 0; precision != 17; ++precision) {
+    snprintf(buf, sizeof(buf), "%.*e", precision, v);
+    if (strtod(buf, (char**)0) == v) {
+      break;
+    }
+  }
+
+  // buf is now "[-]d[.ddd]e(+|-)x[x]". Split it into digits and exponent.
+  const char* p = buf;
+  if (*p == '-') {
+    out.append(1, '-');
+    ++p;
+  }
+  char digits[20];
+  int k = 0;
+  for (; *p != 'e'; ++p) {
+    if (*p != '.') { digits[k++] = *p; }
+  }
+  int n = atoi(p + 1) + 1; // position of the decimal point relative to digits
+
+  if (k <= n && n <= 21) {
+    out.append(digits, k);
+    out.append(n - k, '0');
+  } else if (0 < n && n <= 21) {
+    out.append(digits, n);
+    out.append(1, '.');
+    out.append(digits + n, k - n);
+  } else if (-6 < n && n <= 0) {
+    out.append("0.");
+    out.append(-n, '0');
+    out.append(digits, k);
+  } else {
+    out.append(digits, 1);
+    if (k > 1) {
+      out.append(1, '.');
+      out.append(digits + 1, k - 1);
+    }
+    snprintf(buf, sizeof(buf), "e%c%d", (n - 1 < 0) ? '-' : '+',
+             (n - 1 < 0) ? 1 - n : n - 1);
+    out.append(buf);
+  }
+  return true;
+}
+
+// Reads one code point from UTF-8 `p` and returns its UTF-16 code unit(s) as
+// a value which orders the same as the code units do (high unit in the upper
+// half.) Invalid bytes are returned as-is.
+inline uint32_t _utf16_order_key(const uint8_t*& p, const uint8_t* end) {
+  uint32_t cp = *p++;
+  size_t n = (cp >= 0xf0) ? 3 : (cp >= 0xe0) ? 2 : (cp >= 0xc0) ? 1 : 0;
+  if (n != 0 && (size_t)(end - p) >= n) {
+    cp &= (0x3f >> n);
+    while (n--) {
+      cp = (cp << 6) | (*p++ & 0x3f);
+    }
+  }
+  if (cp >= 0x10000) {
+    cp -= 0x10000;
+    return ((0xd800 + (cp >> 10)) << 16) | (0xdc00 + (cp & 0x3ff));
+  }
+  return cp << 16;
+}
+
+struct Canonicalizer::MemberOrder {
+  explicit MemberOrder(const std::string& arena)
+    : bytes((const uint8_t*)arena.data()) {}
+  bool operator()(const Member& a, const Member& b) const {
+    // Order by UTF-16 code units
+    const uint8_t* pa = bytes + a.key;
+    const uint8_t* enda = pa + a.keyLength;
+    const uint8_t* pb = bytes + b.key;
+    const uint8_t* endb = pb + b.keyLength;
+    while (pa != enda && pb != endb) {
+      if (*pa < 0x80 && *pb < 0x80) {
+        // fast path for ASCII
+        if (*pa != *pb) { return *pa < *pb; }
+        ++pa; ++pb;
+        continue;
+      }
+      uint32_t ka = _utf16_order_key(pa, enda);
+      uint32_t kb = _utf16_order_key(pb, endb);
+      if (ka != kb) { return ka < kb; }
+    }
+    return (pa == enda) && (pb != endb);
+  }
+  const uint8_t* bytes;
+};
+
+JSONT_INLINE bool Canonicalizer::transcode(Tokenizer& tokenizer, Builder& builder) {
+  _arena.clear();
+  _members.clear();
+  if (!readValue(tokenizer)) {
+    return false;
+  }
+  builder.rawValue(_arena.data(), _arena.size());
+  return true;
+}
+
+JSONT_INLINE bool Canonicalizer::readValue(Tokenizer& t) {
+  switch (t.current()) {
+    case ObjectStart: return readObject(t);
+    case ArrayStart:  return readArray(t);
+    case True:        _arena.append("true"); return true;
+    case False:       _arena.append("false"); return true;
+    case Null:        _arena.append("null"); return true;
+    case Integer:
+    case Float:       return _append_canonical_number(_arena, t.floatValue());
+    case String: {
+      const char* bytes = 0;
+      size_t size = t.dataValue(&bytes);
+      _append_canonical_string(_arena, bytes, size);
+      return true;
+    }
+    default:          return false;
+  }
+}
+
+JSONT_INLINE bool Canonicalizer::readArray(Tokenizer& t) {
+  _arena.append(1, '[');
+  bool first = true;
+  while (t.next() != ArrayEnd) {
+    if (!first) {
+      _arena.append(1, ',');
+    }
+    first = false;
+    if (!readValue(t)) {
+      return false;
+    }
+  }
+  _arena.append(1, ']');
+  return true;
+}
+
+JSONT_INLINE bool Canonicalizer::readObject(Tokenizer& t) {
+  // Members are read into the arena in input order, then the object is
+  // written in key order past them and finally moved down to where it began.
+  size_t start = _arena.size();
+  size_t firstMember = _members.size();
+  while (t.next() != ObjectEnd) {
+    if (t.current() != FieldName) {
+      return false;
+    }
+    Member m;
+    const char* bytes = 0;
+    m.keyLength = t.dataValue(&bytes);
+    m.key = _arena.size();
+    _arena.append(bytes, m.keyLength);
+    t.next();
+    m.value = _arena.size();
+    if (!readValue(t)) {
+      return false;
+    }
+    m.valueLength = _arena.size() - m.value;
+    _members.push_back(m);
+  }
+
+  std::sort(_members.begin() + firstMember, _members.end(),
+            MemberOrder(_arena));
+
+  // Keys are escaped from the arena into the arena, so make sure it won't be
+  // reallocated while doing so. Escaping grows a key at most six times.
+  size_t end = _arena.size();
+  size_t nmembers = _members.size() - firstMember;
+  _arena.reserve(end + 2 + ((end - start) * 6) + (nmembers * 4));
+  _arena.append(1, '{');
+  for (size_t i = firstMember; i != _members.size(); ++i) {
+    const Member& m = _members[i];
+    if (i != firstMember) {
+      _arena.append(1, ',');
+    }
+    _append_canonical_string(_arena, _arena.data() + m.key, m.keyLength);
+    _arena.append(1, ':');
+    _arena.append(_arena, m.value, m.valueLength);
+  }
+  _arena.append(1, '}');
+  _arena.erase(start, end - start);
+  _members.resize(firstMember);
+  return true;
+}
+
+// ----------------- Template -----------------
+
+// Returns true if `json` is exactly one well-formed value
+inline bool _is_single_value(const std::string& json) {
+  Tokenizer t(json.data(), json.size(), UTF8TextEncoding);
+  size_t depth = 0;
+  size_t values = 0;
+  for (Token tok = t.current(); ; tok = t.next()) {
+    switch (tok) {
+      case End:
+        return values == 1 && depth == 0;
+      case Error:
+        return false;
+      case ObjectStart:
+      case ArrayStart:
+        if (depth++ == 0) { ++values; }
+        break;
+      case ObjectEnd:
+      case ArrayEnd:
+        --depth;
+        break;
+      case FieldName:
+        break;
+      default:
+        if (depth == 0) { ++values; }
+        break;
+    }
+  }
+}
+
+JSONT_INLINE void Template::compile(const char* skeleton, size_t length) {
+  const char* end = skeleton + length;
+  bool inString = false;
+  for (const char* p = skeleton; p != end; ++p) {
+    char b = *p;
+    if (inString) {
+      if (b == '\\' && p+1 != end) {
+        _fragments += b;
+        b = *++p;
+      } else if (b == '"') {
+        inString = false;
+      }
+    } else if (b == ' ' || b == '\t' || b == '\r' || b == '\n') {
+      continue;
+    } else if (b == '?') {
+      _ends.push_back(_fragments.size());
+      continue;
+    } else if (b == '"') {
+      inString = true;
+    }
+    _fragments += b;
+  }
+  _ends.push_back(_fragments.size());
+
+  // Check the skeleton with a null in each hole
+  std::string check(_fragments, 0, _ends[0]);
+  for (size_t i = 1; i != _ends.size(); ++i) {
+    check += "null";
+    check.append(_fragments, _ends[i-1], _ends[i] - _ends[i-1]);
+  }
+  if (!_is_single_value(check)) {
+    throw std::invalid_argument("malformed JSON template");
+  }
+
+  if (_has_non_ascii(_fragments.data(), _fragments.size())) {
+    for (size_t i = 0; i != _ends.size(); ++i) {
+      size_t begin = (i == 0) ? 0 : _ends[i-1];
+      _append_ascii_only(_asciiFragments, _fragments.data() + begin,
+                         _ends[i] - begin);
+      _asciiEnds.push_back(_asciiFragments.size());
+    }
+  }
+}
+
 } // namespace jsont
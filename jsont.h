@@ -12,6 +12,7 @@
 #ifndef _JSONT_IN_SOURCE
 typedef struct jsont_ctx jsont_ctx_t;
 typedef uint8_t jsont_tok_t;
+typedef struct jsont_builder jsont_builder_t;
 #endif
 
 #ifndef JSONT_ERRINFO_CUSTOM
@@ -43,6 +44,31 @@ enum {
   _JSONT_COMMA,
 };
 
+// A token and the location of its value in the input, as read in bulk by
+// `jsont_next_batch`. For strings and field names, the location is of the
+// bytes between the quotes, which contain escape sequences if `flags` has
+// JSONT_RECORD_ESCAPED set. For other tokens, it's of the literal, bracket or
+// brace, or is empty for JSONT_END and JSONT_ERR.
+typedef struct {
+  jsont_tok_t tok;
+  uint8_t flags;
+  size_t offset; // into the input
+  size_t length;
+} jsont_record_t;
+#define JSONT_RECORD_ESCAPED 1
+
+// Maximum depth of nested objects and arrays
+#define JSONT_MAX_DEPTH 512
+
+// Instruction set levels, as returned by `jsont_simd_level`
+typedef enum {
+  JSONT_SIMD_NONE = 0,
+  JSONT_SIMD_SSE2,
+  JSONT_SIMD_SSE42,
+  JSONT_SIMD_AVX2,
+  JSONT_SIMD_AVX512,
+} jsont_simd_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -57,9 +83,25 @@ void jsont_destroy(jsont_ctx_t* ctx);
 
 // Reset the tokenizer to parse the data pointed to by `bytes`. The tokenizer
 // does NOT take ownership of `bytes`. This function can be used to recycle a
-// tokenizer context, minimizing memory reallocation.
+// tokenizer context, minimizing memory reallocation. A NUL byte ends the input
+// like `length` does, so a zero-filled buffer can be passed in full. Input
+// ending inside a token, e.g. a string, is an error (JSONT_ERR.)
 void jsont_reset(jsont_ctx_t* ctx, const uint8_t* bytes, size_t length);
 
+// Number of zero bytes which must follow input passed to `jsont_reset_padded`
+#define JSONT_PADDING 64
+
+// Like `jsont_reset`, but `bytes` must be followed by JSONT_PADDING bytes of
+// zeros (e.g. as allocated by `jsont_alloc_padded`.) This allows the tokenizer
+// to read a block at a time rather than checking for the end of input at
+// every byte.
+void jsont_reset_padded(jsont_ctx_t* ctx, const uint8_t* bytes,
+                        size_t length);
+
+// Allocate room for `length` bytes of input followed by JSONT_PADDING zero
+// bytes, for use with `jsont_reset_padded`. Free it with `free()`.
+uint8_t* jsont_alloc_padded(size_t length);
+
 // Read and return the next token. See `jsont_tok_t` enum for a list of
 // possible return values and their meaning.
 jsont_tok_t jsont_next(jsont_ctx_t* ctx);
@@ -67,6 +109,15 @@ jsont_tok_t jsont_next(jsont_ctx_t* ctx);
 // Returns the current token (last token read by `jsont_next`).
 jsont_tok_t jsont_current(const jsont_ctx_t* ctx);
 
+// Read up to `max` tokens into `records`, stopping after JSONT_END or JSONT_ERR.
+// Returns the number of records written. The last one is the current token.
+size_t jsont_next_batch(jsont_ctx_t* ctx, jsont_record_t* records, size_t max);
+
+// Unescape `length` bytes of a string value at `bytes`, e.g. as located by a
+// record flagged JSONT_RECORD_ESCAPED, into `dst` which must have room for
+// `length` bytes. Returns the number of bytes written.
+size_t jsont_unescape(const uint8_t* bytes, size_t length, uint8_t* dst);
+
 // Returns a slice of the input which represents the current value, or nothing
 // (returns 0) if the current token has no value (e.g. start of an object).
 size_t jsont_data_value(jsont_ctx_t* ctx, const uint8_t** bytes);
@@ -106,6 +157,84 @@ jsont_err_t jsont_error_info(jsont_ctx_t* ctx);
 // Returns the value passed to `jsont_create`.
 void* jsont_user_data(const jsont_ctx_t* ctx);
 
+// Instruction set level of the kernels used to scan and escape strings. On x86
+// with GCC or clang, this is the best the CPU supports, detected on first use,
+// or the lower level named by the environment variable JSONT_SIMD ("none",
+// "sse2", "sse4.2", "avx2" or "avx512".) Otherwise it's fixed at build time.
+jsont_simd_t jsont_simd_level(void);
+
+// ----------------- Builder -----------------
+
+// Called by a builder to consume `length` bytes of output at `bytes`, either
+// because its buffer is full or from `jsont_builder_flush`. Return false to
+// signal an error (e.g. a failed write.)
+typedef bool (*jsont_flush_fn)(jsont_builder_t* b, const uint8_t* bytes,
+                               size_t length);
+
+// Create a new JSON builder. `user_data` can be anything and is accessible
+// through `jsont_builder_user_data`. By default, output is collected in a
+// growing heap buffer.
+jsont_builder_t* jsont_builder_create(void* user_data);
+
+// Destroy a builder. This will free any internal data, except from a buffer
+// passed to `jsont_builder_set_buffer`.
+void jsont_builder_destroy(jsont_builder_t* b);
+
+// Discard any output and errors, making it possible to reuse the builder and
+// its buffer.
+void jsont_builder_reset(jsont_builder_t* b);
+
+// Write output into `capacity` bytes at `buf`, owned by the caller, instead of
+// a heap buffer. No memory is allocated by the builder. When the buffer is
+// full, output is passed to the flush function or, if there is none, the
+// builder fails with an error.
+void jsont_builder_set_buffer(jsont_builder_t* b, uint8_t* buf,
+                              size_t capacity);
+
+// Have `flush` consume output when the buffer is full, rather than growing it.
+void jsont_builder_set_flush(jsont_builder_t* b, jsont_flush_fn flush);
+
+// Pass any buffered output to the flush function. Returns false on error.
+bool jsont_builder_flush(jsont_builder_t* b);
+
+// Add structure, field names and values. These return false on error, after
+// which any further calls fail until `jsont_builder_reset` is called.
+bool jsont_builder_object_start(jsont_builder_t* b);
+bool jsont_builder_object_end(jsont_builder_t* b);
+bool jsont_builder_array_start(jsont_builder_t* b);
+bool jsont_builder_array_end(jsont_builder_t* b);
+bool jsont_builder_field(jsont_builder_t* b, const uint8_t* name,
+                         size_t length);
+bool jsont_builder_string(jsont_builder_t* b, const uint8_t* bytes,
+                          size_t length);
+bool jsont_builder_int(jsont_builder_t* b, int64_t v);
+bool jsont_builder_double(jsont_builder_t* b, double v);
+bool jsont_builder_bool(jsont_builder_t* b, bool v);
+bool jsont_builder_null(jsont_builder_t* b);
+
+// Add a value which is already serialized as JSON, verbatim
+bool jsont_builder_raw(jsont_builder_t* b, const uint8_t* json, size_t length);
+
+// Convenience functions for field names and values which are C strings
+static inline bool jsont_builder_field_str(jsont_builder_t* b,
+                                           const char* name) {
+  return jsont_builder_field(b, (const uint8_t*)name, strlen(name));
+}
+static inline bool jsont_builder_str(jsont_builder_t* b, const char* str) {
+  return jsont_builder_string(b, (const uint8_t*)str, strlen(str));
+}
+
+// Returns the output which has not yet been flushed, or NULL if there is
+// none. Sets `length` to the number of readable bytes at the returned pointer.
+const uint8_t* jsont_builder_bytes(const jsont_builder_t* b, size_t* length);
+
+// Get information on the last error. Returns NULL if no error has occured
+// since the builder was created or reset.
+jsont_err_t jsont_builder_error_info(const jsont_builder_t* b);
+
+// Returns the value passed to `jsont_builder_create`.
+void* jsont_builder_user_data(const jsont_builder_t* b);
+
 // ----------------- C++ -----------------
 #ifdef __cplusplus
 } // extern "C"
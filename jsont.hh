@@ -11,17 +11,78 @@
 #include <math.h>
 #include <assert.h>
 #include <string>
+#include <vector>
 #include <stdexcept>
+#include <new>       // bad_alloc
+#include "jsont_scan.h"
+
+// `__has_feature` is clang-only and can't be used in an expression elsewhere
+#ifdef __has_feature
+  #define _JSONT_HAS_FEATURE(x) __has_feature(x)
+#else
+  #define _JSONT_HAS_FEATURE(x) 0
+#endif
 
 // Can haz rvalue references with move semantics?
 #if (defined(_MSC_VER) && _MSC_VER >= 1600) || \
     (defined(__GXX_EXPERIMENTAL_CXX0X__) && __GXX_EXPERIMENTAL_CXX0X__) || \
-    (defined(__has_feature) && __has_feature(cxx_rvalue_references))
+    _JSONT_HAS_FEATURE(cxx_rvalue_references)
   #define JSONT_CXX_RVALUE_REFS 1
 #else
   #define JSONT_CXX_RVALUE_REFS 0
 #endif
 
+// Can haz std::thread? Define as 0 to leave out `buildChunks`.
+#ifndef JSONT_CXX_THREADS
+  #if (defined(_MSC_VER) && _MSC_VER >= 1700) || __cplusplus >= 201103L
+    #define JSONT_CXX_THREADS 1
+  #else
+    #define JSONT_CXX_THREADS 0
+  #endif
+#endif
+#if JSONT_CXX_THREADS
+  #include <thread>
+  #include <exception> // exception_ptr
+#endif
+
+// Can haz std::atomic? Otherwise `SharedBytes` counts references with the
+// compiler's own atomic intrinsics.
+#ifndef JSONT_CXX_ATOMIC
+  #if (defined(_MSC_VER) && _MSC_VER >= 1700) || __cplusplus >= 201103L
+    #define JSONT_CXX_ATOMIC 1
+  #else
+    #define JSONT_CXX_ATOMIC 0
+  #endif
+#endif
+#if JSONT_CXX_ATOMIC
+  #include <atomic>
+#elif defined(_MSC_VER)
+  #include <intrin.h>
+#endif
+
+// Can haz std::string_view? Define as 0 to leave out `Tokenizer::view` and
+// `parse`.
+#ifndef JSONT_CXX_STRING_VIEW
+  #if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+    #define JSONT_CXX_STRING_VIEW 1
+  #else
+    #define JSONT_CXX_STRING_VIEW 0
+  #endif
+#endif
+#if JSONT_CXX_STRING_VIEW
+  #include <string_view>
+  #include "jsont_kernels.h" // the scanner, which `parse` includes
+#endif
+
+// Define JSONT_HEADER_ONLY to compile the implementation (jsont.cc) into every
+// translation unit including this header instead of linking with it. This
+// lets the compiler inline `Tokenizer::next` and friends into your own loops.
+#ifdef JSONT_HEADER_ONLY
+  #define JSONT_INLINE inline
+#else
+  #define JSONT_INLINE
+#endif
+
 namespace jsont {
 
 // Tokens
@@ -50,7 +111,33 @@ typedef enum {
 // Name of `token`
 const char* token_name(jsont::Token token);
 
-class TokenizerInternal;
+// Instruction set levels
+typedef enum {
+  NoSIMD = 0,
+  SSE2SIMD,
+  SSE42SIMD,
+  AVX2SIMD,
+  AVX512SIMD,
+} SIMDLevel;
+
+// Instruction set level of the kernels used to scan and escape strings. On x86
+// with GCC or clang, this is the best the CPU supports, detected on first use,
+// or the lower level named by the environment variable JSONT_SIMD ("none",
+// "sse2", "sse4.2", "avx2" or "avx512".) Otherwise it's fixed at build time.
+SIMDLevel simdLevel();
+
+// A token and the location of its value in the input, as read in bulk by
+// `Tokenizer::nextBatch`. For strings and field names, the location is of the
+// bytes between the quotes, which contain escape sequences if `flags` has
+// Escaped set. For other tokens, it's of the literal, bracket or brace, or is
+// empty for End and Error.
+struct TokenRecord {
+  enum { Escaped = 1 }; // flags
+  Token token;
+  uint32_t flags;
+  size_t offset; // into input
+  size_t length;
+};
 
 // Reads a sequence of bytes and produces tokens and values while doing so
 class Tokenizer {
@@ -61,23 +148,82 @@ public:
   // Read next token
   const Token& next();
 
+  // Read next token of input known to be valid JSON, like that produced by
+  // Builder. Skips all syntax checks: atoms are recognized by their first
+  // byte, commas and number grammar are not checked, and a NUL byte only ends
+  // the input between values. Nesting is still tracked, so it can be mixed with `next`. Malformed input yields
+  // unspecified tokens, but is never read past its end.
+  const Token& nextTrusted();
+
   // Access current token
   const Token& current() const;
 
+  // Read up to `max` tokens into `records`, stopping after End or Error.
+  // Returns the number of records written. The last one is the current token.
+  size_t nextBatch(TokenRecord* records, size_t max);
+
+  // The current token as a record
+  TokenRecord record() const;
+
   // Reset the tokenizer, making it possible to reuse this parser so to avoid
-  // unnecessary memory allocation and deallocation.
+  // unnecessary memory allocation and deallocation. A NUL byte ends the input
+  // like `length` does, so a zero-filled buffer can be passed in full. Input
+  // ending inside a token, e.g. a string, is an error.
   void reset(const char* bytes, size_t length, TextEncoding encoding);
 
+  // Number of zero bytes which must follow input passed to `resetPadded`
+  enum { Padding = 64 };
+
+  // Maximum depth of nested objects and arrays
+  enum { MaxDepth = _JSONT_MAX_DEPTH };
+
+  // Like `reset`, but `bytes` must be followed by `Padding` zero bytes, as
+  // allocated by `allocPadded`. This allows the tokenizer to read a block at
+  // a time rather than checking for the end of input at every byte, and to
+  // parse numbers at the end of input in place.
+  void resetPadded(const char* bytes, size_t length, TextEncoding encoding);
+
+  // Allocate room for `length` bytes of input followed by `Padding` zero
+  // bytes. Free it with `free()`. Returns NULL if out of memory.
+  static char* allocPadded(size_t length);
+
   // True if the current token has a value
   bool hasValue() const;
 
   // Returns a slice of the input which represents the current value, or nothing
   // (returns 0) if the current token has no value (e.g. start of an object).
-  size_t dataValue(const char const** bytes) const;
+  // Strings with escape sequences are unescaped into a buffer on first access.
+  size_t dataValue(const char** bytes) const;
+
+  // Returns the current value as it appears in the input, i.e. for strings
+  // and field names the bytes between the quotes with any escape sequences
+  // left as-is. Returns 0 if the current token has no value. Pass the result to
+  // `Builder::valueEscaped` to re-emit a string without unescaping it.
+  size_t escapedValue(const char** bytes) const;
+
+  // Returns the exact input bytes of the value starting at the current token,
+  // e.g. a whole object including its braces, without reading the tokens
+  // inside it. The tokenizer is left at the last token of the value, so `next`
+  // continues after it. Objects and arrays are only checked for matching
+  // brackets, nested no deeper than MaxDepth, and terminated strings. Returns
+  // 0 if the current token doesn't start a value, or sets the token to Error if
+  // the value is malformed in these ways or unterminated.
+  size_t rawValue(const char** bytes);
 
   // Returns a *copy* of the current string value.
   std::string stringValue() const;
 
+  // Replace the contents of `str` with, or append to it, the current value.
+  // Unlike `stringValue`, these reuse the capacity of `str`.
+  void assignTo(std::string& str) const;
+  void appendTo(std::string& str) const;
+
+#if JSONT_CXX_STRING_VIEW
+  // Returns the current value without copying it, like `dataValue`. The view
+  // is valid until the next call to `next` or `reset`.
+  std::string_view view() const;
+#endif
+
   // Returns the current value as a double-precision floating-point number.
   double floatValue() const;
 
@@ -87,6 +233,12 @@ public:
   // Returns the current value as a boolean
   bool boolValue() const;
 
+  // Like `assignTo`, `floatValue` and `intValue` but for a token read by
+  // `nextBatch`, which remains valid until `reset` is called.
+  void assignTo(const TokenRecord& record, std::string& str) const;
+  double floatValue(const TokenRecord& record) const;
+  int64_t intValue(const TokenRecord& record) const;
+
   // Error codes
   typedef enum {
     UnspecifiedError = 0,
@@ -98,6 +250,10 @@ public:
     MalformedNumberLiteral,
     UnterminatedString,
     SyntaxError,
+    UnexpectedColon,
+    UnexpectedObjectEnd,
+    UnexpectedArrayEnd,
+    NestingTooDeep,
   } ErrorCode;
 
   // Returns the error code of the last error
@@ -116,38 +272,123 @@ public:
   // A pointer to the input data as passed to `reset` or the constructor.
   const char* inputBytes() const;
 
-  friend class TokenizerInternal;
 private:
-  size_t availableInput() const;
-  size_t endOfInput() const;
-  const Token& setToken(Token t);
-  const Token& setError(ErrorCode error);
-
-  struct {
-    const uint8_t* bytes;
-    size_t length;
-    size_t offset;
-  } _input;
+  const Token& setError(uint8_t scanError);
+  bool valueTerminated() const;
+  void unescape() const;
+
+  _jsont_scan_t _scan; // input, current value and nesting
   struct Value {
-    Value() : offset(0), length(0), buffered(false) {}
-    void beginAtOffset(size_t z);
-    size_t offset; // into _input.bytes
-    size_t length;
-    std::string buffer;
-    bool buffered; // if true, contents lives in buffer
+    Value() : buffered(false) {}
+    mutable std::string buffer; // unescaped contents, made on demand
+    mutable bool buffered;      // if true, buffer is up to date
   } _value;
   Token _token;
-  struct {
-    ErrorCode code;
-  } _error;
 };
 
 
+// A field name which has been quoted, escaped and terminated by a colon up
+// front, so that adding it to a Builder is a single memcpy. Create keys once
+// (e.g. as static constants) and reuse them. A non-ASCII key also keeps the
+// form used by builders in ASCII-only mode.
+class Key {
+public:
+  Key(const char* name, size_t length, TextEncoding e=UTF8TextEncoding);
+  Key(const char* name);
+  Key(const std::string& name, TextEncoding e=UTF8TextEncoding);
+
+  // The serialized key, e.g. `"name":`
+  size_t size() const;
+  const char* bytes() const;
+
+  friend class Builder;
+private:
+  void init(const char* name, size_t length, TextEncoding e);
+  std::string _bytes;
+  std::string _asciiBytes; // non-ASCII escaped, or empty if _bytes is ASCII
+};
+
+
+// An immutable, reference-counted byte buffer. Copies share the same bytes and
+// may be passed between threads, making it suitable for handing one serialized
+// document to many consumers.
+class SharedBytes {
+public:
+  SharedBytes() : _block(0) {}
+  SharedBytes(const SharedBytes& other);
+  SharedBytes& operator=(const SharedBytes& other);
+  ~SharedBytes();
+
+  size_t size() const;
+  const char* bytes() const;
+  bool empty() const;
+
+  friend class Builder;
+private:
+  // Takes ownership of `bytes` which must have been allocated with malloc
+  SharedBytes(char* bytes, size_t size);
+  void retain();
+  void release();
+  struct Block {
+#if JSONT_CXX_ATOMIC
+    std::atomic<long> refs;
+#else
+    volatile long refs;
+#endif
+    size_t size;
+    char* bytes;
+  }* _block;
+};
+
+
+class ArrayChunks;
+class Template;
+class UncheckedAppender;
+
 // Helps in building JSON, providing a final sequential byte buffer
 class Builder {
 public:
-  Builder() : _buf(0), _capacity(0), _size(0), _state(NeutralState) {}
-  ~Builder() { if (_buf) { free(_buf); _buf = 0; } }
+  // Kinds of backing buffer
+  typedef enum {
+    MallocStorage = 0, // buffer allocated with malloc (default)
+    StringStorage,     // std::string, which `takeString` hands over as-is
+    VectorStorage,     // std::vector<char>, which `takeVector` hands over as-is
+    ExternalStorage,   // buffer provided by the caller
+  } Storage;
+
+  // What a builder writing into caller-provided storage does when the output
+  // does not fit
+  typedef enum {
+    GrowOnOverflow = 0, // move the output to a heap buffer and carry on
+    ThrowOnOverflow,    // throw std::length_error
+  } OverflowPolicy;
+
+  Builder() : _buf(0), _capacity(0), _size(0), _state(NeutralState)
+            , _depth(0), _indentWidth(0)
+            , _storage(MallocStorage), _overflow(GrowOnOverflow)
+            , _asciiOnly(false), _utf8Validation(TrustUTF8) {}
+
+  // Build into a `storage` kind of backing buffer. ExternalStorage requires a
+  // buffer; see the constructor below.
+  explicit Builder(Storage storage)
+      : _buf(0), _capacity(0), _size(0), _state(NeutralState)
+      , _depth(0), _indentWidth(0)
+      , _storage(storage), _overflow(GrowOnOverflow)
+      , _asciiOnly(false), _utf8Validation(TrustUTF8) {
+    assert(storage != ExternalStorage);
+  }
+
+  // Build into `capacity` bytes at `buf`, owned by the caller. No memory is
+  // allocated as long as the output fits. When it doesn't, `overflow` decides
+  // what happens. If an exception is thrown, the contents of the builder are
+  // undefined until `reset` is called.
+  Builder(char* buf, size_t capacity, OverflowPolicy overflow=GrowOnOverflow)
+      : _buf(buf), _capacity(capacity), _size(0), _state(NeutralState)
+      , _depth(0), _indentWidth(0)
+      , _storage(ExternalStorage), _overflow(overflow)
+      , _asciiOnly(false), _utf8Validation(TrustUTF8) {}
+
+  ~Builder() { if (_buf && _storage == MallocStorage) { free(_buf); } _buf = 0; }
   Builder(const Builder& other);
   Builder& operator=(const Builder& other);
 #if JSONT_CXX_RVALUE_REFS
@@ -161,40 +402,122 @@ public:
   Builder& endArray();
   Builder& fieldName(const char* v, size_t length, TextEncoding e=UTF8TextEncoding);
   Builder& fieldName(const std::string& name, TextEncoding enc=UTF8TextEncoding);
+  Builder& field(const Key& key);
   Builder& value(const char* v, size_t length, TextEncoding e=UTF8TextEncoding);
   Builder& value(const char* v);
   Builder& value(const std::string& v);
   Builder& value(double v);
-  Builder& value(int64_t v);
+  Builder& value(long long v); // int64_t is either this or long
   Builder& value(int v);
   Builder& value(unsigned int v);
   Builder& value(long v);
+  Builder& value(unsigned long long v);
+  Builder& value(unsigned long v);
   Builder& value(bool v);
   Builder& nullValue();
+  Builder& value(const ArrayChunks& array);
+  Builder& rawValue(const char* json, size_t length);
+
+  // Add a string value or field name which is already escaped, e.g. as read
+  // by `Tokenizer::escapedValue`, by copying it verbatim between quotes. The
+  // ASCII-only and UTF-8 validation modes don't apply. When `check` is true,
+  // throws std::invalid_argument unless `v` is validly escaped: no quotes,
+  // backslashes or control characters except in well-formed escape sequences.
+  Builder& valueEscaped(const char* v, size_t length, bool check=false);
+  Builder& fieldNameEscaped(const char* v, size_t length, bool check=false);
+
+  // Add `count` numbers, as if calling `value` for each one of them but
+  // considerably faster for large arrays.
+  Builder& values(const double* v, size_t count);
+  Builder& values(const long long* v, size_t count); // or int64_t as long
+  Builder& values(const int* v, size_t count);
+  Builder& values(const unsigned int* v, size_t count);
+  Builder& values(const long* v, size_t count);
+  Builder& values(const unsigned long long* v, size_t count);
+  Builder& values(const unsigned long* v, size_t count);
+
+  // Indentation styles for pretty-printing
+  typedef enum {
+    NoIndentation = 0, // minimal output (default)
+    SpaceIndentation,
+    TabIndentation,
+  } Indentation;
+
+  // Pretty-print the output, putting each value on its own line indented by
+  // `width` spaces or tabs per nesting level. Has no effect on the cost of
+  // building when `style` is NoIndentation.
+  Builder& setIndentation(Indentation style, size_t width=2);
+
+  // Produce pure ASCII output by writing any non-ASCII character in strings as
+  // a "\uXXXX" escape sequence (or a pair of them for characters outside the
+  // BMP.) Invalid UTF-8 is written as U+FFFD. Applies to Keys and Template
+  // fragments too, but not to input copied as is by `valueEscaped`,
+  // `fieldNameEscaped`, `rawValue` or an UncheckedAppender.
+  Builder& setASCIIOnly(bool asciiOnly);
+
+  // How strings added to the builder are checked for valid UTF-8
+  typedef enum {
+    TrustUTF8 = 0,      // don't check (default)
+    RejectInvalidUTF8,  // throw std::invalid_argument
+    ReplaceInvalidUTF8, // write each invalid byte as U+FFFD
+  } UTF8Validation;
+
+  // Check strings for valid UTF-8 as they are escaped. Runs of ASCII are
+  // checked 16 bytes at a time. If an exception is thrown, the contents of the
+  // builder are undefined until `reset` is called.
+  Builder& setUTF8Validation(UTF8Validation validation);
+
+  // Make room for at least `size` more bytes, to avoid growing the buffer
+  // repeatedly when the size of what follows is known or estimated. Has no
+  // effect on caller-provided storage.
+  Builder& sizeHint(size_t size);
 
   size_t size() const;
   const char* bytes() const;
   std::string toString() const;
   const char* seizeBytes(size_t& size_out);
+  std::string takeString();
+  std::vector<char> takeVector();
+  SharedBytes share();
   const void reset();
 
+  friend class Template;
+  friend class UncheckedAppender;
 private:
   size_t available() const;
   void reserve(size_t size);
+  void grow(size_t size);
+  void attachContainer();
   void prefix();
+  void prettyPrefix();
+  void appendNewline();
   Builder& appendString(const uint8_t* v, size_t length, TextEncoding enc);
+  Builder& appendEscapedString(const char* v, size_t length);
+  static void checkEscaped(const char* v, size_t length);
   Builder& appendChar(char byte);
+  Builder& appendBytes(const char* bytes, size_t size);
+  template <typename T> Builder& appendValues(const T* v, size_t count);
 
   char*  _buf;
   size_t _capacity;
   size_t _size;
-  enum {
+  enum State {
     NeutralState = 0,
     AfterFieldName,
+    AfterKey, // like AfterFieldName but with the colon already written
     AfterValue,
     AfterObjectStart,
     AfterArrayStart,
   } _state;
+  size_t _depth;       // current nesting level
+  size_t _indentWidth; // 0 when not pretty-printing
+  std::string _indent; // "\n" followed by a run of indentation characters
+  Storage _storage;
+  OverflowPolicy _overflow;
+  bool _asciiOnly;
+  UTF8Validation _utf8Validation;
+  std::string _str;       // backing buffer when _storage is StringStorage
+  std::vector<char> _vec; // backing buffer when _storage is VectorStorage
 };
 
 
@@ -202,8 +525,260 @@ private:
 inline Builder build() { return Builder(); }
 
 
+// The elements of a large array, built in chunks which are independent of
+// each other (e.g. one per thread) and joined in order.
+class ArrayChunks {
+public:
+  explicit ArrayChunks(size_t count) : _chunks(count) {}
+
+  // Number of chunks
+  size_t count() const;
+
+  // Builder for chunk `i`. Add the chunk's elements to it as values.
+  Builder& chunk(size_t i);
+  const Builder& chunk(size_t i) const;
+
+  // Size in bytes of the joined array, including brackets and commas
+  size_t size() const;
+
+  // Number of entries needed to describe the joined array with `toIOVecs`
+  size_t iovecCount() const;
+
+  // Describe the joined array as (base, length) entries in `iov`, referencing
+  // the chunks' bytes rather than copying them. `IOVec` is any type with
+  // `iov_base` and `iov_len` members, like `struct iovec` for `writev`.
+  // Returns the number of entries written, or 0 if `max` is less than
+  // `iovecCount()`.
+  template <typename IOVec> size_t toIOVecs(IOVec* iov, size_t max) const;
+
+private:
+  std::vector<Builder> _chunks;
+};
+
+// A scope in which values are appended to a builder without checking its
+// capacity, for hot loops whose output size can be bounded up front. `size`
+// bytes are reserved on construction, written through a local cursor and
+// committed to the builder on destruction. Going past the reservation is only
+// caught by assertions in debug builds. Output is minified: the builder must
+// not be pretty-printing. Strings are written as-is, without the builder's
+// ASCII-only or UTF-8 validation modes, and need up to 6 bytes per input byte
+// plus 2 for the quotes. Don't use the builder directly while the scope lives.
+class UncheckedAppender {
+public:
+  UncheckedAppender(Builder& builder, size_t size);
+  ~UncheckedAppender();
+
+  UncheckedAppender& startObject();
+  UncheckedAppender& endObject();
+  UncheckedAppender& startArray();
+  UncheckedAppender& endArray();
+  UncheckedAppender& field(const Key& key);
+  UncheckedAppender& value(const char* v, size_t length);
+  UncheckedAppender& value(const char* v);
+  UncheckedAppender& value(const std::string& v);
+  UncheckedAppender& value(double v);
+  UncheckedAppender& value(long long v); // int64_t is either this or long
+  UncheckedAppender& value(int v);
+  UncheckedAppender& value(unsigned int v);
+  UncheckedAppender& value(long v);
+  UncheckedAppender& value(unsigned long long v);
+  UncheckedAppender& value(unsigned long v);
+  UncheckedAppender& value(bool v);
+  UncheckedAppender& nullValue();
+  UncheckedAppender& rawValue(const char* json, size_t length);
+
+  // Bytes left of the reservation
+  size_t available() const;
+
+private:
+  UncheckedAppender(const UncheckedAppender&);
+  UncheckedAppender& operator=(const UncheckedAppender&);
+  void prefix();
+  void put(char byte);
+  void put(const char* bytes, size_t size);
+
+  Builder& _builder;
+  char* _cursor;
+  char* _end;
+  Builder::State _state;
+};
+
+// A document of fixed shape, compiled once from a skeleton in which each `?`
+// outside of a string is a hole for a value, e.g. `{"id":?,"tags":[?,?]}`.
+// Whitespace is removed and everything else is kept pre-serialized, so that
+// rendering copies the constant parts in one go and only formats the values.
+// Strings in the skeleton must already be escaped. Throws
+// std::invalid_argument if the skeleton isn't a JSON value with holes in place
+// of values.
+class Template {
+public:
+  explicit Template(const char* skeleton);
+  Template(const char* skeleton, size_t length);
+
+  // Number of holes
+  size_t holeCount() const;
+
+  // Fills the holes of one rendering, in order. Each call writes a value
+  // followed by the constant bytes leading up to the next hole.
+  class Renderer {
+  public:
+    Renderer& value(const char* v, size_t length, TextEncoding e=UTF8TextEncoding);
+    Renderer& value(const char* v);
+    Renderer& value(const std::string& v);
+    Renderer& value(double v);
+    Renderer& value(long long v); // int64_t is either this or long
+    Renderer& value(int v);
+    Renderer& value(unsigned int v);
+    Renderer& value(long v);
+    Renderer& value(unsigned long long v);
+    Renderer& value(unsigned long v);
+    Renderer& value(bool v);
+    Renderer& nullValue();
+    Renderer& rawValue(const char* json, size_t length);
+
+    // True when all holes have been filled
+    bool done() const;
+
+    friend class Template;
+  private:
+    Renderer(const Template& t, Builder& builder);
+    Renderer& next();
+    Renderer& fill(const char* v, size_t size);
+    const Template& _template;
+    Builder& _builder;
+    const std::string& _fragments;    // of _template, for _builder's mode
+    const std::vector<size_t>& _ends;
+    size_t _hole; // next hole to fill
+  };
+
+  // Add a rendering of this template to `builder` as a value. The document is
+  // complete once every hole has been filled through the returned Renderer.
+  // When `builder` is pretty-printing, the document itself is not indented.
+  Renderer render(Builder& builder) const;
+
+private:
+  void compile(const char* skeleton, size_t length);
+  std::string _fragments;    // constant parts, back to back
+  std::vector<size_t> _ends; // end offset of each fragment in _fragments
+  // The same with non-ASCII escaped, for ASCII-only builders. Empty if the
+  // fragments are ASCII.
+  std::string _asciiFragments;
+  std::vector<size_t> _asciiEnds;
+};
+
+// Transcodes JSON into its canonical form as defined by RFC 8785 (JSON
+// Canonicalization Scheme): object members sorted by key, numbers in their
+// shortest round-trip form and strings minimally escaped. Reuse an instance to
+// avoid reallocating its scratch memory.
+class Canonicalizer {
+public:
+  // Read the value starting at the current token of `tokenizer` and add its
+  // canonical form to `builder`. The tokenizer is left at the last token of the
+  // value. Returns false if the input is malformed or contains a number which
+  // can not be represented (e.g. an overflowing exponent).
+  bool transcode(Tokenizer& tokenizer, Builder& builder);
+
+private:
+  bool readValue(Tokenizer& tokenizer);
+  bool readObject(Tokenizer& tokenizer);
+  bool readArray(Tokenizer& tokenizer);
+
+  // An object member, as offsets into _arena
+  struct Member {
+    size_t key, keyLength;
+    size_t value, valueLength;
+  };
+  struct MemberOrder;
+
+  std::string _arena;            // canonical values, built depth-first
+  std::vector<Member> _members;  // stack of members of the objects being read
+};
+
+#if JSONT_CXX_THREADS
+// Build `count` items into `chunks` using one thread per chunk, each thread
+// handling a contiguous range of items by calling `fn(Builder&, const T&)`.
+// Add the result to a builder with `Builder::value(const ArrayChunks&)`.
+// If `fn` throws, its thread stops and, once every thread has been joined,
+// the exception of the lowest-numbered chunk that threw is rethrown. The
+// chunks are then in an unspecified state; reset them before reusing them.
+template <typename T, typename F>
+void buildChunks(ArrayChunks& chunks, const T* items, size_t count, F fn);
+#endif
+
+#if JSONT_CXX_STRING_VIEW
+// Handler for `parse` which ignores everything. Derive from it and define the
+// methods you need; they are called on the static type of the handler, so no
+// methods are virtual and calls can be inlined.
+struct Handler {
+  void onObjectStart() {}
+  void onObjectEnd() {}
+  void onArrayStart() {}
+  void onArrayEnd() {}
+  void onKey(std::string_view) {}
+  void onString(std::string_view) {}
+  void onInt(int64_t) {}
+  void onFloat(double) {}
+  void onBool(bool) {}
+  void onNull() {}
+  void onError(Tokenizer::ErrorCode, size_t) {}
+};
+
+// Parse `length` bytes of JSON at `bytes`, calling the methods of `handler`
+// for each token as it's read. Returns false, after calling `handler.onError`,
+// if the input is malformed or ends inside an object or array. Like Tokenizer,
+// accepts any number of top-level values one after another (e.g. newline-
+// delimited JSON), but at least one: input which is empty or only whitespace
+// is a PrematureEndOfInput error at offset 0. The scanner of `Tokenizer::next`
+// is compiled into the loop, and numbers are parsed in place.
+template <typename H> bool parse(const char* bytes, size_t length, H& handler);
+#endif
+
+
 // ------------------- internal ---------------------
 
+// Token for a scanner token (kScanToken*). Tables are function-local so that
+// they are the same in every translation unit of a JSONT_HEADER_ONLY build.
+inline Token _token_of(uint8_t scanToken) {
+  static const Token kTokens[] = {
+    End, Error, ObjectStart, ObjectEnd, ArrayStart, ArrayEnd, True, False, Null,
+    End /* _JSONT_VALUES_START */, Integer, Float, String, FieldName,
+    End /* _JSONT_VALUES_END */, _Comma,
+  };
+  return kTokens[scanToken];
+}
+
+// Error code for a scanner error (kScanError*)
+inline Tokenizer::ErrorCode _error_code_of(uint8_t scanError) {
+  static const Tokenizer::ErrorCode kErrorCodes[] = {
+    Tokenizer::UnspecifiedError,
+    Tokenizer::PrematureEndOfInput,
+    Tokenizer::UnterminatedString,
+    Tokenizer::InvalidByte,
+    Tokenizer::SyntaxError,
+    Tokenizer::UnexpectedComma,
+    Tokenizer::UnexpectedTrailingComma,
+    Tokenizer::UnexpectedColon,
+    Tokenizer::MalformedNumberLiteral,
+    Tokenizer::MalformedUnicodeEscapeSequence,
+    Tokenizer::UnexpectedObjectEnd,
+    Tokenizer::UnexpectedArrayEnd,
+    Tokenizer::NestingTooDeep,
+  };
+  return kErrorCodes[scanError];
+}
+
+inline Key::Key(const char* name, size_t length, TextEncoding e) {
+  init(name, length, e);
+}
+inline Key::Key(const char* name) {
+  init(name, strlen(name), UTF8TextEncoding);
+}
+inline Key::Key(const std::string& name, TextEncoding e) {
+  init(name.data(), name.size(), e);
+}
+inline size_t Key::size() const { return _bytes.size(); }
+inline const char* Key::bytes() const { return _bytes.data(); }
+
 inline Tokenizer::Tokenizer(const char* bytes, size_t length,
     TextEncoding encoding) : _token(End) {
   reset(bytes, length, encoding);
@@ -221,62 +796,85 @@ inline std::string Tokenizer::stringValue() const {
   return std::string(bytes, size);
 }
 
-inline bool Tokenizer::boolValue() const {
-  return _token == True;
+inline void Tokenizer::assignTo(std::string& str) const {
+  const char* bytes = 0;
+  size_t size = dataValue(&bytes);
+  str.assign(bytes, size);
 }
 
-inline size_t Tokenizer::availableInput() const {
-  return _input.length - _input.offset;
+inline void Tokenizer::appendTo(std::string& str) const {
+  const char* bytes = 0;
+  size_t size = dataValue(&bytes);
+  str.append(bytes, size);
 }
-inline size_t Tokenizer::endOfInput() const {
-  return _input.offset == _input.length;
+
+#if JSONT_CXX_STRING_VIEW
+inline std::string_view Tokenizer::view() const {
+  const char* bytes = 0;
+  size_t size = dataValue(&bytes);
+  return std::string_view(bytes, size);
 }
-inline const Token& Tokenizer::setToken(Token t) {
-  return _token = t;
+#endif
+
+inline bool Tokenizer::boolValue() const {
+  return _token == True;
 }
-inline const Token& Tokenizer::setError(Tokenizer::ErrorCode error) {
-  _error.code = error;
+
+inline const Token& Tokenizer::setError(uint8_t scanError) {
+  _scan.error = scanError;
+  _scan.tok = kScanTokenError;
   return _token = Error;
 }
+// True unless the current value is a number at the very end of unpadded input
+inline bool Tokenizer::valueTerminated() const {
+  return _scan.value_offset + _scan.value_length != _scan.length ||
+         _scan.padded;
+}
 inline size_t Tokenizer::inputOffset() const {
-  return _input.offset;
+  return _scan.offset;
 }
 inline size_t Tokenizer::inputSize() const {
-  return _input.length;
+  return _scan.length;
 }
 inline const char* Tokenizer::inputBytes() const {
-  return (const char*)_input.bytes;
-}
-
-inline void Tokenizer::Value::beginAtOffset(size_t z) {
-  offset = z;
-  length = 0;
-  buffered = false;
+  return (const char*)_scan.bytes;
 }
 
-inline Tokenizer::ErrorCode Tokenizer::error() const {
-  return _error.code;
+inline size_t Tokenizer::escapedValue(const char** bytes) const {
+  if (!hasValue()) { return 0; }
+  *bytes = (const char*)(_scan.bytes + _scan.value_offset);
+  return _scan.value_length;
 }
 
 
 inline Builder& Builder::startObject() {
   prefix();
+  ++_depth;
   _state = AfterObjectStart;
   return appendChar('{');
 }
 
 inline Builder& Builder::endObject() {
+  --_depth;
+  if (_indentWidth != 0 && _state != AfterObjectStart) {
+    appendNewline();
+  }
   _state = AfterValue;
   return appendChar('}');
 }
 
 inline Builder& Builder::startArray() {
   prefix();
+  ++_depth;
   _state = AfterArrayStart;
   return appendChar('[');
 }
 
 inline Builder& Builder::endArray() {
+  --_depth;
+  if (_indentWidth != 0 && _state != AfterArrayStart) {
+    appendNewline();
+  }
   _state = AfterValue;
   return appendChar(']');
 }
@@ -292,12 +890,40 @@ inline Builder& Builder::fieldName(const char* v, size_t length,
   return appendString((const uint8_t*)v, length, enc);
 }
 
+inline Builder& Builder::field(const Key& key) {
+  prefix();
+  _state = AfterKey;
+  const std::string& bytes = (_asciiOnly && !key._asciiBytes.empty())
+                           ? key._asciiBytes : key._bytes;
+  appendBytes(bytes.data(), bytes.size());
+  if (_indentWidth != 0) {
+    appendChar(' ');
+  }
+  return *this;
+}
+
 inline Builder& Builder::value(const char* v, size_t length, TextEncoding enc) {
   prefix();
   _state = AfterValue;
   return appendString((const uint8_t*)v, length, enc);
 }
 
+inline Builder& Builder::valueEscaped(const char* v, size_t length,
+    bool check) {
+  if (check) { checkEscaped(v, length); }
+  prefix();
+  _state = AfterValue;
+  return appendEscapedString(v, length);
+}
+
+inline Builder& Builder::fieldNameEscaped(const char* v, size_t length,
+    bool check) {
+  if (check) { checkEscaped(v, length); }
+  prefix();
+  _state = AfterFieldName;
+  return appendEscapedString(v, length);
+}
+
 inline Builder& Builder::value(const char* v) {
   return value(v, strlen(v));
 }
@@ -306,30 +932,13 @@ inline Builder& Builder::value(const std::string& v) {
   return value(v.data(), v.size());
 }
 
-inline Builder& Builder::value(double v) {
-  prefix();
-  reserve(256);
-  int z = snprintf(_buf+_size, 256, "%g", v);
-  assert(z < 256);
-  _size += z;
-  _state = AfterValue;
-  return *this;
-}
-
-inline Builder& Builder::value(int64_t v) {
-  prefix();
-  reserve(21);
-  int z = snprintf(_buf+_size, 21, "%lld", v);
-  assert(z < 21);
-  _size += z;
-  _state = AfterValue;
-  return *this;
+inline Builder& Builder::value(int v) { return value((long long)v); }
+inline Builder& Builder::value(unsigned int v) { return value((long long)v); }
+inline Builder& Builder::value(long v) { return value((long long)v); }
+inline Builder& Builder::value(unsigned long v) {
+  return value((unsigned long long)v);
 }
 
-inline Builder& Builder::value(int v) { return value((int64_t)v); }
-inline Builder& Builder::value(unsigned int v) { return value((int64_t)v); }
-inline Builder& Builder::value(long v) { return value((int64_t)v); }
-
 inline Builder& Builder::value(bool v) {
   prefix();
   if (v) {
@@ -364,14 +973,28 @@ inline Builder& Builder::nullValue() {
   return *this;
 }
 
+inline Builder& Builder::sizeHint(size_t size) {
+  if (_storage != ExternalStorage) {
+    reserve(size);
+  }
+  return *this;
+}
+
 inline size_t Builder::size() const { return _size; }
 inline const char* Builder::bytes() const { return _buf; }
 inline std::string Builder::toString() const {
   return std::string(bytes(), size());
 }
 inline const char* Builder::seizeBytes(size_t& size_out) {
-  const char* buf = _buf;
   size_out = _size;
+  if (_storage != MallocStorage) {
+    // Only a malloc'd buffer can be handed over to be free'd by the caller
+    char* copy = (char*)malloc(_size);
+    memcpy((void*)copy, (const void*)_buf, _size);
+    reset();
+    return copy;
+  }
+  const char* buf = _buf;
   _buf = 0;
   _capacity = 0;
   reset();
@@ -379,42 +1002,425 @@ inline const char* Builder::seizeBytes(size_t& size_out) {
 }
 inline const void Builder::reset() {
   _size = 0;
+  _depth = 0;
   _state = NeutralState;
 }
 
+inline SharedBytes::SharedBytes(const SharedBytes& other)
+    : _block(other._block) {
+  retain();
+}
+inline SharedBytes& SharedBytes::operator=(const SharedBytes& other) {
+  if (_block != other._block) {
+    release();
+    _block = other._block;
+    retain();
+  }
+  return *this;
+}
+inline void SharedBytes::retain() {
+  if (!_block) { return; }
+#if JSONT_CXX_ATOMIC
+  _block->refs.fetch_add(1, std::memory_order_relaxed);
+#elif defined(_MSC_VER)
+  _InterlockedIncrement(&_block->refs);
+#else
+  __sync_add_and_fetch(&_block->refs, 1);
+#endif
+}
+inline SharedBytes::~SharedBytes() { release(); }
+inline size_t SharedBytes::size() const { return _block ? _block->size : 0; }
+inline const char* SharedBytes::bytes() const {
+  return _block ? _block->bytes : 0;
+}
+inline bool SharedBytes::empty() const { return size() == 0; }
+
+inline size_t ArrayChunks::count() const { return _chunks.size(); }
+inline Builder& ArrayChunks::chunk(size_t i) { return _chunks[i]; }
+inline const Builder& ArrayChunks::chunk(size_t i) const {
+  return _chunks[i];
+}
+
+template <typename IOVec>
+size_t ArrayChunks::toIOVecs(IOVec* iov, size_t max) const {
+  if (max < iovecCount()) {
+    return 0;
+  }
+  size_t n = 0;
+  iov[n].iov_base = (void*)"[";
+  iov[n++].iov_len = 1;
+  for (size_t i = 0; i != _chunks.size(); ++i) {
+    const Builder& b = _chunks[i];
+    if (b.size() == 0) {
+      continue;
+    }
+    if (n != 1) {
+      iov[n].iov_base = (void*)",";
+      iov[n++].iov_len = 1;
+    }
+    iov[n].iov_base = (void*)b.bytes();
+    iov[n++].iov_len = b.size();
+  }
+  iov[n].iov_base = (void*)"]";
+  iov[n++].iov_len = 1;
+  return n;
+}
+
+#if JSONT_CXX_STRING_VIEW
+template <typename H>
+bool parse(const char* bytes, size_t length, H& handler) {
+  _jsont_scan_t scan;
+  _jsont_scan_t* s = &scan;
+  _jsont_scan_reset(s, (const uint8_t*)bytes, length, false);
+  std::string unescaped; // reused for strings with escape sequences
+  bool any = false;
+  for (;;) {
+    // Each token of the scanner goes straight to the handler below, rather
+    // than through a Tokenizer and its value accessors
+    uint8_t token;
+    #define _JSONT_SCAN_RETURN(tok) do { token = (tok); goto scanned; } while (0)
+    #include "jsont_scan_next.h"
+    #undef _JSONT_SCAN_RETURN
+    scanned:
+    const char* value = bytes + scan.value_offset;
+    switch (token) {
+      case kScanTokenObjectStart: handler.onObjectStart(); break;
+      case kScanTokenObjectEnd:   handler.onObjectEnd(); break;
+      case kScanTokenArrayStart:  handler.onArrayStart(); break;
+      case kScanTokenArrayEnd:    handler.onArrayEnd(); break;
+      case kScanTokenTrue:        handler.onBool(true); break;
+      case kScanTokenFalse:       handler.onBool(false); break;
+      case kScanTokenNull:        handler.onNull(); break;
+      case kScanTokenInt:
+        handler.onInt(_jsont_parse_int(value, scan.value_length,
+          scan.value_offset + scan.value_length != length));
+        break;
+      case kScanTokenFloat:
+        handler.onFloat(_jsont_parse_float(value, scan.value_length,
+          scan.value_offset + scan.value_length != length));
+        break;
+      case kScanTokenString: case kScanTokenFieldName: {
+        size_t size = scan.value_length;
+        if (scan.value_escaped) {
+          unescaped.resize(size);
+          size = _jsont_unescape((const uint8_t*)value,
+                                 (const uint8_t*)value + size,
+                                 (uint8_t*)&unescaped[0]);
+          value = unescaped.data();
+        }
+        if (token == kScanTokenString) {
+          handler.onString(std::string_view(value, size));
+        } else {
+          handler.onKey(std::string_view(value, size));
+        }
+        break;
+      }
+      case kScanTokenEnd:
+        if (scan.depth == 0 && any) {
+          return true;
+        }
+        // The scanner leaves it to the caller to decide whether more input
+        // may follow, but here there is none.
+        handler.onError(Tokenizer::PrematureEndOfInput, any ? scan.offset : 0);
+        return false;
+      default: // kScanTokenError
+        handler.onError(_error_code_of(scan.error), scan.offset);
+        return false;
+    }
+    any = true;
+  }
+}
+#endif
+
+#if JSONT_CXX_THREADS
+template <typename T, typename F>
+void buildChunks(ArrayChunks& chunks, const T* items, size_t count, F fn) {
+  size_t nchunks = chunks.count();
+  if (nchunks == 0) {
+    return;
+  }
+  size_t perChunk = (count + nchunks - 1) / nchunks;
+  std::vector<std::exception_ptr> errors(nchunks);
+  std::vector<std::thread> threads;
+  threads.reserve(nchunks);
+  try {
+    for (size_t i = 0; i != nchunks && i * perChunk < count; ++i) {
+      const T* begin = items + (i * perChunk);
+      const T* end = (count - (i * perChunk) < perChunk) ? items + count
+                                                         : begin + perChunk;
+      Builder& b = chunks.chunk(i);
+      std::exception_ptr& error = errors[i];
+      threads.push_back(std::thread([&b, &error, begin, end, fn]() {
+        try {
+          for (const T* it = begin; it != end; ++it) {
+            fn(b, *it);
+          }
+        } catch (...) {
+          error = std::current_exception();
+        }
+      }));
+    }
+  } catch (...) {
+    // std::thread failed to start one; the others must still be joined
+    for (size_t i = 0; i != threads.size(); ++i) {
+      threads[i].join();
+    }
+    throw;
+  }
+  for (size_t i = 0; i != threads.size(); ++i) {
+    threads[i].join();
+  }
+  for (size_t i = 0; i != errors.size(); ++i) {
+    if (errors[i]) {
+      std::rethrow_exception(errors[i]);
+    }
+  }
+}
+#endif
+
+inline UncheckedAppender::UncheckedAppender(Builder& builder, size_t size)
+    : _builder(builder) {
+  assert(builder._indentWidth == 0 /* pretty-printing is not supported */);
+  _builder.reserve(size);
+  _cursor = _builder._buf + _builder._size;
+  _end = _builder._buf + _builder._capacity;
+  _state = _builder._state;
+}
+inline UncheckedAppender::~UncheckedAppender() {
+  _builder._size = _cursor - _builder._buf;
+  _builder._state = _state;
+}
+inline size_t UncheckedAppender::available() const { return _end - _cursor; }
+inline void UncheckedAppender::put(char byte) {
+  assert(_cursor != _end);
+  *_cursor++ = byte;
+}
+inline void UncheckedAppender::put(const char* bytes, size_t size) {
+  assert(available() >= size);
+  memcpy((void*)_cursor, (const void*)bytes, size);
+  _cursor += size;
+}
+inline void UncheckedAppender::prefix() {
+  if (_state == Builder::AfterFieldName) {
+    put(':');
+  } else if (_state == Builder::AfterValue) {
+    put(',');
+  }
+}
+inline UncheckedAppender& UncheckedAppender::startObject() {
+  prefix();
+  ++_builder._depth;
+  _state = Builder::AfterObjectStart;
+  put('{');
+  return *this;
+}
+inline UncheckedAppender& UncheckedAppender::endObject() {
+  --_builder._depth;
+  _state = Builder::AfterValue;
+  put('}');
+  return *this;
+}
+inline UncheckedAppender& UncheckedAppender::startArray() {
+  prefix();
+  ++_builder._depth;
+  _state = Builder::AfterArrayStart;
+  put('[');
+  return *this;
+}
+inline UncheckedAppender& UncheckedAppender::endArray() {
+  --_builder._depth;
+  _state = Builder::AfterValue;
+  put(']');
+  return *this;
+}
+inline UncheckedAppender& UncheckedAppender::field(const Key& key) {
+  prefix();
+  _state = Builder::AfterKey;
+  put(key.bytes(), key.size());
+  return *this;
+}
+inline UncheckedAppender& UncheckedAppender::value(const char* v) {
+  return value(v, strlen(v));
+}
+inline UncheckedAppender& UncheckedAppender::value(const std::string& v) {
+  return value(v.data(), v.size());
+}
+inline UncheckedAppender& UncheckedAppender::value(int v) {
+  return value((long long)v);
+}
+inline UncheckedAppender& UncheckedAppender::value(unsigned int v) {
+  return value((long long)v);
+}
+inline UncheckedAppender& UncheckedAppender::value(long v) {
+  return value((long long)v);
+}
+inline UncheckedAppender& UncheckedAppender::value(unsigned long v) {
+  return value((unsigned long long)v);
+}
+inline UncheckedAppender& UncheckedAppender::value(bool v) {
+  prefix();
+  _state = Builder::AfterValue;
+  if (v) {
+    put("true", 4);
+  } else {
+    put("false", 5);
+  }
+  return *this;
+}
+inline UncheckedAppender& UncheckedAppender::nullValue() {
+  prefix();
+  _state = Builder::AfterValue;
+  put("null", 4);
+  return *this;
+}
+inline UncheckedAppender& UncheckedAppender::rawValue(const char* json,
+    size_t length) {
+  prefix();
+  _state = Builder::AfterValue;
+  put(json, length);
+  return *this;
+}
+
+inline Template::Template(const char* skeleton) {
+  compile(skeleton, strlen(skeleton));
+}
+inline Template::Template(const char* skeleton, size_t length) {
+  compile(skeleton, length);
+}
+inline size_t Template::holeCount() const { return _ends.size() - 1; }
+inline Template::Renderer Template::render(Builder& builder) const {
+  return Renderer(*this, builder);
+}
+
+inline Template::Renderer::Renderer(const Template& t, Builder& builder)
+    : _template(t), _builder(builder)
+    , _fragments(builder._asciiOnly && !t._asciiFragments.empty()
+                 ? t._asciiFragments : t._fragments)
+    , _ends(builder._asciiOnly && !t._asciiFragments.empty()
+            ? t._asciiEnds : t._ends)
+    , _hole(0) {
+  _builder.prefix();
+  _builder._state = Builder::AfterValue;
+  if (_ends[0] != 0) {
+    _builder.appendBytes(_fragments.data(), _ends[0]);
+  }
+}
+inline bool Template::Renderer::done() const {
+  return _hole == _template.holeCount();
+}
+inline Template::Renderer& Template::Renderer::next() {
+  size_t begin = _ends[_hole++];
+  _builder.appendBytes(_fragments.data() + begin, _ends[_hole] - begin);
+  return *this;
+}
+// Writes a serialized value and the fragment following it
+inline Template::Renderer& Template::Renderer::fill(const char* v, size_t size) {
+  assert(!done());
+  size_t begin = _ends[_hole++];
+  size_t fragmentSize = _ends[_hole] - begin;
+  _builder.reserve(size + fragmentSize);
+  char* dst = _builder._buf + _builder._size;
+  memcpy((void*)dst, (const void*)v, size);
+  memcpy((void*)(dst + size),
+         (const void*)(_fragments.data() + begin), fragmentSize);
+  _builder._size += size + fragmentSize;
+  return *this;
+}
+inline Template::Renderer& Template::Renderer::value(const char* v,
+    size_t length, TextEncoding enc) {
+  assert(!done());
+  _builder.appendString((const uint8_t*)v, length, enc);
+  return next();
+}
+inline Template::Renderer& Template::Renderer::value(const char* v) {
+  return value(v, strlen(v));
+}
+inline Template::Renderer& Template::Renderer::value(const std::string& v) {
+  return value(v.data(), v.size());
+}
+inline Template::Renderer& Template::Renderer::value(int v) {
+  return value((long long)v);
+}
+inline Template::Renderer& Template::Renderer::value(unsigned int v) {
+  return value((long long)v);
+}
+inline Template::Renderer& Template::Renderer::value(long v) {
+  return value((long long)v);
+}
+inline Template::Renderer& Template::Renderer::value(unsigned long v) {
+  return value((unsigned long long)v);
+}
+inline Template::Renderer& Template::Renderer::value(bool v) {
+  return v ? fill("true", 4) : fill("false", 5);
+}
+inline Template::Renderer& Template::Renderer::nullValue() {
+  return fill("null", 4);
+}
+inline Template::Renderer& Template::Renderer::rawValue(const char* json,
+    size_t length) {
+  return fill(json, length);
+}
+
 inline size_t Builder::available() const {
   return _capacity - _size;
 }
 
 inline void Builder::reserve(size_t size) {
   if (available() < size) {
+    if (_storage != MallocStorage) {
+      return grow(size);
+    }
     #if 0
     // exact allocation for debugging purposes
     printf("DEBUG Builder::reserve: size=%zu available=%zu grow_by=%zu\n",
       size, available(), (size - available()) );
-    _capacity += size - available();
+    size_t capacity = _capacity + (size - available());
     #else
-    _capacity += size - available();
-    _capacity = (_capacity < 64) ? 64 : (_capacity * 1.5);
+    size_t capacity = _capacity + (size - available());
+    capacity = (capacity < 64) ? 64 : (capacity * 1.5);
     #endif
-    _buf = (char*)realloc((void*)_buf, _capacity);
+    char* buf = (char*)realloc((void*)_buf, capacity);
+    if (buf == 0) {
+      throw std::bad_alloc();
+    }
+    _buf = buf;
+    _capacity = capacity;
   }
 }
 
 inline void Builder::prefix() {
-  if (_state == AfterFieldName) {
+  if (_indentWidth != 0) {
+    prettyPrefix();
+  } else if (_state == AfterFieldName) {
     appendChar(':');
   } else if (_state == AfterValue) {
     appendChar(',');
   }
 }
 
+inline Builder& Builder::rawValue(const char* json, size_t length) {
+  prefix();
+  _state = AfterValue;
+  return appendBytes(json, length);
+}
+
 inline Builder& Builder::appendChar(char byte) {
   reserve(1);
   _buf[_size++] = byte;
   return *this;
 }
 
+inline Builder& Builder::appendBytes(const char* bytes, size_t size) {
+  reserve(size);
+  memcpy((void*)(_buf+_size), (const void*)bytes, size);
+  _size += size;
+  return *this;
 }
 
+}
+
+#ifdef JSONT_HEADER_ONLY
+  #include "jsont.cc"
+#endif
+
 #endif // JSONT_CXX_INCLUDED
@@ -0,0 +1,1185 @@
+// JSON Tokenizer and builder. Copyright (c) 2012, Rasmus Andersson. All rights
+// reserved. Use of this source code is governed by a MIT-style license that can
+// be found in the LICENSE file.
+//
+// Internal kernels shared by the C and C++ implementations. Not part of the
+// public API.
+#ifndef JSONT_KERNELS_INCLUDED
+#define JSONT_KERNELS_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h> // getenv, strtod
+#include <math.h>   // NAN
+#include <float.h>  // FLT_EVAL_METHOD
+#include "jsont_scan.h" // _jsont_scan_t, kScanToken*
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define _JSONT_SSE2 1
+#else
+  #define _JSONT_SSE2 0
+#endif
+
+// On x86 with GCC or clang, kernels for instruction sets beyond the target's
+// baseline are compiled with target attributes, and those for the best one
+// the CPU supports are used (see _jsont_simd_level.) Define as 0 to only use
+// the baseline.
+#ifndef _JSONT_X86_DISPATCH
+  #if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define _JSONT_X86_DISPATCH 1
+  #else
+    #define _JSONT_X86_DISPATCH 0
+  #endif
+#endif
+#if _JSONT_X86_DISPATCH
+  #include <immintrin.h>
+  #define _JSONT_TARGET(isa) __attribute__((target(isa)))
+#else
+  #define _JSONT_TARGET(isa)
+#endif
+
+enum {
+  kUTF8ByteVerbatim = 0,
+  kUTF8ByteEncode1, // "\u000x"
+  kUTF8ByteEncode2, // "\u00xx"
+};
+#define V kUTF8ByteVerbatim
+#define E1 kUTF8ByteEncode1
+#define E2 kUTF8ByteEncode2
+static const uint8_t kUTF8ByteTable[256] = {
+  E1, E1, E1, E1, E1, E1, E1, E1, 'b', 't', 'n', E1, 'f', 'r', E1, E1, E2, E2,
+  E2, E2, E2, E2, E2, E2, E2, E2, E2, E2, E2, E2, E2, E2, V, V, '"', V, V, V, V,
+  V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
+  V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
+  V, '\\', V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
+  V, V, V, V, V, V, V, V, V, V, V, E2, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
+  V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
+  V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
+  V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
+  V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
+  V, V, V, V, V, V, V, V, V, V
+};
+#undef V
+#undef E1
+#undef E2
+
+// Classes of bytes, as read by the tokenizer. Bytes which can't start or
+// continue a token are kByteClassInvalid.
+enum {
+  kByteClassInvalid = 0,
+  kByteClassSpace,        // ' ' '\t' '\r' '\n'
+  kByteClassObjectStart,  // {
+  kByteClassObjectEnd,    // }
+  kByteClassArrayStart,   // [
+  kByteClassArrayEnd,     // ]
+  kByteClassQuote,        // "
+  kByteClassComma,        // ,
+  kByteClassColon,        // :
+  kByteClassDigit,        // 0-9
+  kByteClassSign,         // - +
+  kByteClassFloatMark,    // . e E
+  kByteClassNull,         // n
+  kByteClassTrue,         // t
+  kByteClassFalse,        // f
+};
+#define x kByteClassInvalid
+#define W kByteClassSpace
+#define OS kByteClassObjectStart
+#define OE kByteClassObjectEnd
+#define AS kByteClassArrayStart
+#define AE kByteClassArrayEnd
+#define Q kByteClassQuote
+#define C kByteClassComma
+#define K kByteClassColon
+#define D kByteClassDigit
+#define S kByteClassSign
+#define FM kByteClassFloatMark
+#define N kByteClassNull
+#define T kByteClassTrue
+#define F kByteClassFalse
+static const uint8_t kByteClassTable[256] = {
+  x, x, x, x, x, x, x, x, x, W, W, x, x, W, x, x, x, x, x, x, x, x, x, x, x, x,
+  x, x, x, x, x, x, W, x, Q, x, x, x, x, x, x, x, x, S, C, S, FM, x, D, D, D, D,
+  D, D, D, D, D, D, K, x, x, x, x, x, x, x, x, x, x, FM, x, x, x, x, x, x, x, x,
+  x, x, x, x, x, x, x, x, x, x, x, x, x, AS, x, AE, x, x, x, x, x, x, x, FM, F,
+  x, x, x, x, x, x, x, N, x, x, x, x, x, T, x, x, x, x, x, x, OS, x, OE, x, x,
+  x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x,
+  x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x,
+  x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x,
+  x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x,
+  x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x
+};
+#undef x
+#undef W
+#undef OS
+#undef OE
+#undef AS
+#undef AE
+#undef Q
+#undef C
+#undef K
+#undef D
+#undef S
+#undef FM
+#undef N
+#undef T
+#undef F
+
+// Loads 4 bytes at `p`, which need not be aligned
+static inline uint32_t _jsont_load32(const uint8_t* p) {
+  uint32_t v;
+  memcpy((void*)&v, (const void*)p, 4);
+  return v;
+}
+
+// Returns a pointer to the first byte in [p,end) which can't be copied verbatim
+// into a JSON string; a byte which is not kUTF8ByteVerbatim or, when
+// `stop_at_non_ascii` is true, any byte >= 0x80. Returns `end` if there is none.
+// Dispatches to the best of the _jsont_find_escape_* kernels below.
+static inline const uint8_t* _jsont_find_escape(const uint8_t* p,
+                                                const uint8_t* end,
+                                                bool stop_at_non_ascii);
+
+// Returns a pointer to the first '"', '\\' or NUL byte at or after `p`, reading
+// a block at a time without any end of input check. One of these bytes must
+// exist before the end of readable memory, less one block of up to 64 bytes,
+// which is true for input followed by 64 zero bytes of padding. Dispatches to
+// the best of the _jsont_find_string_end_padded_* kernels below.
+static inline const uint8_t* _jsont_find_string_end_padded(const uint8_t* p);
+
+// Returns a pointer to the first '"', '\\' or NUL byte in [p,end), or `end` if
+// there is none. For input without padding. Dispatches to the best of the
+// _jsont_find_string_end_* kernels below.
+static inline const uint8_t* _jsont_find_string_end(const uint8_t* p,
+                                                    const uint8_t* end);
+
+// Instruction set levels of kernels, in order. Same as jsont_simd_t.
+enum {
+  kSIMDNone = 0,
+  kSIMDSSE2,
+  kSIMDSSE42,
+  kSIMDAVX2,
+  kSIMDAVX512,
+};
+
+// Byte by byte, for what's left after a kernel's last whole block
+static inline const uint8_t* _jsont_find_escape_tail(const uint8_t* p,
+                                                     const uint8_t* end,
+                                                     bool stop_at_non_ascii) {
+  while ( p != end && kUTF8ByteTable[*p] == kUTF8ByteVerbatim &&
+          (*p < 0x80 || !stop_at_non_ascii) ) {
+    ++p;
+  }
+  return p;
+}
+
+static inline const uint8_t* _jsont_find_string_end_tail(const uint8_t* p,
+                                                         const uint8_t* end) {
+  while (p != end && *p != '"' && *p != '\\' && *p != 0) {
+    ++p;
+  }
+  return p;
+}
+
+// 8 bytes at a time. Any of the tests may report false positives for bytes
+// following a true positive, which is fine as we then go byte by byte.
+#define _JSONT_ONES 0x0101010101010101ULL
+#define _JSONT_HIGHS 0x8080808080808080ULL
+#define _JSONT_HAS_LESS(x, n) (((x) - (_JSONT_ONES * (n))) & ~(x) & _JSONT_HIGHS)
+#define _JSONT_HAS_ZERO(x) _JSONT_HAS_LESS(x, 1)
+
+static inline const uint8_t* _jsont_find_escape_word(const uint8_t* p,
+                                                     const uint8_t* end,
+                                                     bool stop_at_non_ascii) {
+  while (end - p >= 8) {
+    uint64_t w;
+    memcpy((void*)&w, (const void*)p, 8);
+    uint64_t m = _JSONT_HAS_LESS(w, 0x20)
+               | _JSONT_HAS_ZERO(w ^ (_JSONT_ONES * '"'))
+               | _JSONT_HAS_ZERO(w ^ (_JSONT_ONES * '\\'))
+               | _JSONT_HAS_ZERO(w ^ (_JSONT_ONES * 0x7f));
+    if (stop_at_non_ascii) {
+      m |= w & _JSONT_HIGHS;
+    }
+    if (m != 0) {
+      break;
+    }
+    p += 8;
+  }
+  return _jsont_find_escape_tail(p, end, stop_at_non_ascii);
+}
+
+static inline const uint8_t* _jsont_find_string_end_padded_word(
+    const uint8_t* p) {
+  while (1) {
+    uint64_t w;
+    memcpy((void*)&w, (const void*)p, 8);
+    if ( (_JSONT_HAS_ZERO(w) | _JSONT_HAS_ZERO(w ^ (_JSONT_ONES * '"')) |
+          _JSONT_HAS_ZERO(w ^ (_JSONT_ONES * '\\'))) != 0 ) {
+      break;
+    }
+    p += 8;
+  }
+  while (*p != '"' && *p != '\\' && *p != 0) {
+    ++p;
+  }
+  return p;
+}
+
+static inline const uint8_t* _jsont_find_string_end_word(const uint8_t* p,
+                                                         const uint8_t* end) {
+  while (end - p >= 8) {
+    uint64_t w;
+    memcpy((void*)&w, (const void*)p, 8);
+    if ( (_JSONT_HAS_ZERO(w) | _JSONT_HAS_ZERO(w ^ (_JSONT_ONES * '"')) |
+          _JSONT_HAS_ZERO(w ^ (_JSONT_ONES * '\\'))) != 0 ) {
+      break;
+    }
+    p += 8;
+  }
+  return _jsont_find_string_end_tail(p, end);
+}
+
+#undef _JSONT_ONES
+#undef _JSONT_HIGHS
+#undef _JSONT_HAS_LESS
+#undef _JSONT_HAS_ZERO
+
+#if _JSONT_SSE2 || _JSONT_X86_DISPATCH
+
+// Index of the lowest set bit in `mask`, which must not be 0. MSVC builds the
+// SSE2 kernels (_M_X64) but has no __builtin_ctz.
+#ifdef _MSC_VER
+  #include <intrin.h>
+  static inline int _jsont_ctz(int mask) {
+    unsigned long i;
+    _BitScanForward(&i, (unsigned long)mask);
+    return (int)i;
+  }
+#else
+  #define _jsont_ctz(mask) __builtin_ctz(mask)
+#endif
+
+// 16 bytes at a time
+_JSONT_TARGET("sse2")
+static inline const uint8_t* _jsont_find_escape_sse2(const uint8_t* p,
+                                                     const uint8_t* end,
+                                                     bool stop_at_non_ascii) {
+  const __m128i kQuote = _mm_set1_epi8('"');
+  const __m128i kBackslash = _mm_set1_epi8('\\');
+  const __m128i kDelete = _mm_set1_epi8(0x7f);
+  const __m128i kControlMax = _mm_set1_epi8(0x1f);
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i m = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(v, kQuote), _mm_cmpeq_epi8(v, kBackslash)),
+      _mm_or_si128(_mm_cmpeq_epi8(v, kDelete),
+                   // v <= 0x1f (unsigned)
+                   _mm_cmpeq_epi8(_mm_min_epu8(v, kControlMax), v)) );
+    int mask = _mm_movemask_epi8(m);
+    if (stop_at_non_ascii) {
+      mask |= _mm_movemask_epi8(v);
+    }
+    if (mask != 0) {
+      return p + _jsont_ctz(mask);
+    }
+    p += 16;
+  }
+  return _jsont_find_escape_tail(p, end, stop_at_non_ascii);
+}
+
+_JSONT_TARGET("sse2")
+static inline const uint8_t* _jsont_find_string_end_padded_sse2(
+    const uint8_t* p) {
+  const __m128i kQuote = _mm_set1_epi8('"');
+  const __m128i kBackslash = _mm_set1_epi8('\\');
+  const __m128i kZero = _mm_setzero_si128();
+  while (1) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    int mask = _mm_movemask_epi8(_mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(v, kQuote), _mm_cmpeq_epi8(v, kBackslash)),
+      _mm_cmpeq_epi8(v, kZero)) );
+    if (mask != 0) {
+      return p + _jsont_ctz(mask);
+    }
+    p += 16;
+  }
+}
+
+_JSONT_TARGET("sse2")
+static inline const uint8_t* _jsont_find_string_end_sse2(const uint8_t* p,
+                                                         const uint8_t* end) {
+  const __m128i kQuote = _mm_set1_epi8('"');
+  const __m128i kBackslash = _mm_set1_epi8('\\');
+  const __m128i kZero = _mm_setzero_si128();
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    int mask = _mm_movemask_epi8(_mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(v, kQuote), _mm_cmpeq_epi8(v, kBackslash)),
+      _mm_cmpeq_epi8(v, kZero)) );
+    if (mask != 0) {
+      return p + _jsont_ctz(mask);
+    }
+    p += 16;
+  }
+  return _jsont_find_string_end_tail(p, end);
+}
+
+#endif // _JSONT_SSE2 || _JSONT_X86_DISPATCH
+
+#if _JSONT_X86_DISPATCH
+
+// 32 bytes at a time, then 16
+_JSONT_TARGET("avx2")
+static inline const uint8_t* _jsont_find_escape_avx2(const uint8_t* p,
+                                                     const uint8_t* end,
+                                                     bool stop_at_non_ascii) {
+  const __m256i kQuote = _mm256_set1_epi8('"');
+  const __m256i kBackslash = _mm256_set1_epi8('\\');
+  const __m256i kDelete = _mm256_set1_epi8(0x7f);
+  const __m256i kControlMax = _mm256_set1_epi8(0x1f);
+  while (end - p >= 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    __m256i m = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, kQuote),
+                      _mm256_cmpeq_epi8(v, kBackslash)),
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, kDelete),
+                      _mm256_cmpeq_epi8(_mm256_min_epu8(v, kControlMax), v)) );
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(m);
+    if (stop_at_non_ascii) {
+      mask |= (uint32_t)_mm256_movemask_epi8(v);
+    }
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 32;
+  }
+  return _jsont_find_escape_sse2(p, end, stop_at_non_ascii);
+}
+
+_JSONT_TARGET("avx2")
+static inline const uint8_t* _jsont_find_string_end_padded_avx2(
+    const uint8_t* p) {
+  const __m256i kQuote = _mm256_set1_epi8('"');
+  const __m256i kBackslash = _mm256_set1_epi8('\\');
+  const __m256i kZero = _mm256_setzero_si256();
+  while (1) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, kQuote),
+                      _mm256_cmpeq_epi8(v, kBackslash)),
+      _mm256_cmpeq_epi8(v, kZero)) );
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 32;
+  }
+}
+
+_JSONT_TARGET("avx2")
+static inline const uint8_t* _jsont_find_string_end_avx2(const uint8_t* p,
+                                                         const uint8_t* end) {
+  const __m256i kQuote = _mm256_set1_epi8('"');
+  const __m256i kBackslash = _mm256_set1_epi8('\\');
+  const __m256i kZero = _mm256_setzero_si256();
+  while (end - p >= 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, kQuote),
+                      _mm256_cmpeq_epi8(v, kBackslash)),
+      _mm256_cmpeq_epi8(v, kZero)) );
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 32;
+  }
+  return _jsont_find_string_end_sse2(p, end);
+}
+
+// 64 bytes at a time, then 32 and 16
+_JSONT_TARGET("avx512bw")
+static inline const uint8_t* _jsont_find_escape_avx512(const uint8_t* p,
+                                                       const uint8_t* end,
+                                                       bool stop_at_non_ascii) {
+  const __m512i kQuote = _mm512_set1_epi8('"');
+  const __m512i kBackslash = _mm512_set1_epi8('\\');
+  const __m512i kDelete = _mm512_set1_epi8(0x7f);
+  const __m512i kControlMax = _mm512_set1_epi8(0x1f);
+  while (end - p >= 64) {
+    __m512i v = _mm512_loadu_si512((const void*)p);
+    uint64_t mask = _mm512_cmpeq_epi8_mask(v, kQuote)
+                  | _mm512_cmpeq_epi8_mask(v, kBackslash)
+                  | _mm512_cmpeq_epi8_mask(v, kDelete)
+                  | _mm512_cmple_epu8_mask(v, kControlMax);
+    if (stop_at_non_ascii) {
+      mask |= _mm512_movepi8_mask(v);
+    }
+    if (mask != 0) {
+      return p + __builtin_ctzll(mask);
+    }
+    p += 64;
+  }
+  return _jsont_find_escape_avx2(p, end, stop_at_non_ascii);
+}
+
+_JSONT_TARGET("avx512bw")
+static inline const uint8_t* _jsont_find_string_end_padded_avx512(
+    const uint8_t* p) {
+  const __m512i kQuote = _mm512_set1_epi8('"');
+  const __m512i kBackslash = _mm512_set1_epi8('\\');
+  const __m512i kZero = _mm512_setzero_si512();
+  while (1) {
+    __m512i v = _mm512_loadu_si512((const void*)p);
+    uint64_t mask = _mm512_cmpeq_epi8_mask(v, kQuote)
+                  | _mm512_cmpeq_epi8_mask(v, kBackslash)
+                  | _mm512_cmpeq_epi8_mask(v, kZero);
+    if (mask != 0) {
+      return p + __builtin_ctzll(mask);
+    }
+    p += 64;
+  }
+}
+
+_JSONT_TARGET("avx512bw")
+static inline const uint8_t* _jsont_find_string_end_avx512(const uint8_t* p,
+                                                           const uint8_t* end) {
+  const __m512i kQuote = _mm512_set1_epi8('"');
+  const __m512i kBackslash = _mm512_set1_epi8('\\');
+  const __m512i kZero = _mm512_setzero_si512();
+  while (end - p >= 64) {
+    __m512i v = _mm512_loadu_si512((const void*)p);
+    uint64_t mask = _mm512_cmpeq_epi8_mask(v, kQuote)
+                  | _mm512_cmpeq_epi8_mask(v, kBackslash)
+                  | _mm512_cmpeq_epi8_mask(v, kZero);
+    if (mask != 0) {
+      return p + __builtin_ctzll(mask);
+    }
+    p += 64;
+  }
+  return _jsont_find_string_end_avx2(p, end);
+}
+
+// Kernels in use, bound by _jsont_simd_level on first use. Each translation
+// unit using this header has its own copy. Threads may race to bind them, so
+// they are only accessed through these relaxed atomics: racing initializations
+// store the same values, and either the first or the bound kernel is correct.
+#define _JSONT_LOAD(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#define _JSONT_STORE(var, v) __atomic_store_n(&(var), (v), __ATOMIC_RELAXED)
+static const uint8_t* _jsont_find_escape_first(const uint8_t*, const uint8_t*,
+                                               bool);
+static const uint8_t* _jsont_find_string_end_padded_first(const uint8_t*);
+static const uint8_t* _jsont_find_string_end_first(const uint8_t*,
+                                                   const uint8_t*);
+static const uint8_t* (*_jsont_find_escape_fn)(const uint8_t*, const uint8_t*,
+  bool) = _jsont_find_escape_first;
+static const uint8_t* (*_jsont_find_string_end_padded_fn)(const uint8_t*) =
+  _jsont_find_string_end_padded_first;
+static const uint8_t* (*_jsont_find_string_end_fn)(const uint8_t*,
+  const uint8_t*) = _jsont_find_string_end_first;
+
+// Returns the level named by `name` as in the JSONT_SIMD environment
+// variable, or -1 if unknown
+static inline int _jsont_simd_parse(const char* name) {
+  static const char* const kNames[] = {
+    "none", "sse2", "sse4.2", "avx2", "avx512",
+  };
+  int level;
+  for (level = kSIMDNone; level <= kSIMDAVX512; ++level) {
+    if (strcmp(name, kNames[level]) == 0) {
+      return level;
+    }
+  }
+  return -1;
+}
+
+// Detects the instruction set level of the CPU, lowered to the level named by
+// the JSONT_SIMD environment variable if set, and binds the kernels for it.
+// SSE4.2 has nothing to offer over SSE2 for these kernels.
+static inline int _jsont_simd_level(void) {
+  static int level = -1;
+  int detected = _JSONT_LOAD(level);
+  if (detected >= 0) {
+    return detected;
+  }
+  detected = kSIMDNone;
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) { detected = kSIMDSSE2; }
+  if (__builtin_cpu_supports("sse4.2")) { detected = kSIMDSSE42; }
+  if (__builtin_cpu_supports("avx2")) { detected = kSIMDAVX2; }
+  if (__builtin_cpu_supports("avx512bw")) { detected = kSIMDAVX512; }
+  const char* name = getenv("JSONT_SIMD");
+  int forced = (name == 0) ? -1 : _jsont_simd_parse(name);
+  if (forced >= 0 && forced < detected) {
+    detected = forced;
+  }
+  switch (detected) {
+    case kSIMDAVX512:
+      _JSONT_STORE(_jsont_find_escape_fn, &_jsont_find_escape_avx512);
+      _JSONT_STORE(_jsont_find_string_end_padded_fn,
+                   &_jsont_find_string_end_padded_avx512);
+      _JSONT_STORE(_jsont_find_string_end_fn, &_jsont_find_string_end_avx512);
+      break;
+    case kSIMDAVX2:
+      _JSONT_STORE(_jsont_find_escape_fn, &_jsont_find_escape_avx2);
+      _JSONT_STORE(_jsont_find_string_end_padded_fn,
+                   &_jsont_find_string_end_padded_avx2);
+      _JSONT_STORE(_jsont_find_string_end_fn, &_jsont_find_string_end_avx2);
+      break;
+    case kSIMDSSE42: case kSIMDSSE2:
+      _JSONT_STORE(_jsont_find_escape_fn, &_jsont_find_escape_sse2);
+      _JSONT_STORE(_jsont_find_string_end_padded_fn,
+                   &_jsont_find_string_end_padded_sse2);
+      _JSONT_STORE(_jsont_find_string_end_fn, &_jsont_find_string_end_sse2);
+      break;
+    default:
+      _JSONT_STORE(_jsont_find_escape_fn, &_jsont_find_escape_word);
+      _JSONT_STORE(_jsont_find_string_end_padded_fn,
+                   &_jsont_find_string_end_padded_word);
+      _JSONT_STORE(_jsont_find_string_end_fn, &_jsont_find_string_end_word);
+      break;
+  }
+  _JSONT_STORE(level, detected);
+  return detected;
+}
+
+static const uint8_t* _jsont_find_escape_first(const uint8_t* p,
+                                               const uint8_t* end,
+                                               bool stop_at_non_ascii) {
+  _jsont_simd_level();
+  return _JSONT_LOAD(_jsont_find_escape_fn)(p, end, stop_at_non_ascii);
+}
+
+static const uint8_t* _jsont_find_string_end_padded_first(const uint8_t* p) {
+  _jsont_simd_level();
+  return _JSONT_LOAD(_jsont_find_string_end_padded_fn)(p);
+}
+
+static const uint8_t* _jsont_find_string_end_first(const uint8_t* p,
+                                                   const uint8_t* end) {
+  _jsont_simd_level();
+  return _JSONT_LOAD(_jsont_find_string_end_fn)(p, end);
+}
+
+static inline const uint8_t* _jsont_find_escape(const uint8_t* p,
+                                                const uint8_t* end,
+                                                bool stop_at_non_ascii) {
+  return _JSONT_LOAD(_jsont_find_escape_fn)(p, end, stop_at_non_ascii);
+}
+
+static inline const uint8_t* _jsont_find_string_end_padded(const uint8_t* p) {
+  return _JSONT_LOAD(_jsont_find_string_end_padded_fn)(p);
+}
+
+static inline const uint8_t* _jsont_find_string_end(const uint8_t* p,
+                                                    const uint8_t* end) {
+  return _JSONT_LOAD(_jsont_find_string_end_fn)(p, end);
+}
+
+#undef _JSONT_LOAD
+#undef _JSONT_STORE
+
+#else // _JSONT_X86_DISPATCH
+
+static inline int _jsont_simd_level(void) {
+  return _JSONT_SSE2 ? kSIMDSSE2 : kSIMDNone;
+}
+
+static inline const uint8_t* _jsont_find_escape(const uint8_t* p,
+                                                const uint8_t* end,
+                                                bool stop_at_non_ascii) {
+  #if _JSONT_SSE2
+  return _jsont_find_escape_sse2(p, end, stop_at_non_ascii);
+  #else
+  return _jsont_find_escape_word(p, end, stop_at_non_ascii);
+  #endif
+}
+
+static inline const uint8_t* _jsont_find_string_end_padded(const uint8_t* p) {
+  #if _JSONT_SSE2
+  return _jsont_find_string_end_padded_sse2(p);
+  #else
+  return _jsont_find_string_end_padded_word(p);
+  #endif
+}
+
+static inline const uint8_t* _jsont_find_string_end(const uint8_t* p,
+                                                    const uint8_t* end) {
+  #if _JSONT_SSE2
+  return _jsont_find_string_end_sse2(p, end);
+  #else
+  return _jsont_find_string_end_word(p, end);
+  #endif
+}
+
+#endif // _JSONT_X86_DISPATCH
+
+// Decodes one UTF-8 sequence at `p` as defined by RFC 3629. Returns the number
+// of bytes read, or 0 if the sequence is invalid, truncated, overlong or
+// encodes a surrogate.
+static inline size_t _jsont_decode_utf8(const uint8_t* p, const uint8_t* end,
+                                        uint32_t* cp) {
+  uint8_t b = p[0];
+  size_t avail = end - p;
+  if (b < 0xc2) {
+    return 0; // continuation byte or overlong 2-byte sequence
+  } else if (b < 0xe0) {
+    if (avail < 2 || (p[1] & 0xc0) != 0x80) { return 0; }
+    *cp = ((uint32_t)(b & 0x1f) << 6) | (p[1] & 0x3f);
+    return 2;
+  } else if (b < 0xf0) {
+    if (avail < 3 || (p[1] & 0xc0) != 0x80 || (p[2] & 0xc0) != 0x80 ||
+        (b == 0xe0 && p[1] < 0xa0) || // overlong
+        (b == 0xed && p[1] > 0x9f)) { // surrogate
+      return 0;
+    }
+    *cp = ((uint32_t)(b & 0x0f) << 12) | ((uint32_t)(p[1] & 0x3f) << 6)
+        | (p[2] & 0x3f);
+    return 3;
+  } else if (b < 0xf5) {
+    if (avail < 4 || (p[1] & 0xc0) != 0x80 || (p[2] & 0xc0) != 0x80 ||
+        (p[3] & 0xc0) != 0x80 ||
+        (b == 0xf0 && p[1] < 0x90) || // overlong
+        (b == 0xf4 && p[1] > 0x8f)) { // > U+10FFFF
+      return 0;
+    }
+    *cp = ((uint32_t)(b & 0x07) << 18) | ((uint32_t)(p[1] & 0x3f) << 12)
+        | ((uint32_t)(p[2] & 0x3f) << 6) | (p[3] & 0x3f);
+    return 4;
+  }
+  return 0;
+}
+
+// Writes "\uXXXX" for the UTF-16 code unit `u` to `dst`
+static inline void _jsont_write_unicode_escape(char* dst, uint32_t u) {
+  static const char kHex[] = "0123456789ABCDEF";
+  dst[0] = '\\';
+  dst[1] = 'u';
+  dst[2] = kHex[(u >> 12) & 0xf];
+  dst[3] = kHex[(u >> 8) & 0xf];
+  dst[4] = kHex[(u >> 4) & 0xf];
+  dst[5] = kHex[u & 0xf];
+}
+
+// Writes the escape sequence for the ASCII byte `b`, which must not be
+// kUTF8ByteVerbatim, to `dst`. Returns the number of bytes written.
+static inline size_t _jsont_escape_ascii(char* dst, uint8_t b) {
+  uint8_t s = kUTF8ByteTable[b];
+  if (s == kUTF8ByteEncode1 || s == kUTF8ByteEncode2) {
+    _jsont_write_unicode_escape(dst, b);
+    return 6;
+  }
+  // reverse solidus escape
+  dst[0] = '\\';
+  dst[1] = (char)s;
+  return 2;
+}
+
+// Value of the 4 hex digits at `p`, or -1 if any of them is not a hex digit
+static inline int32_t _jsont_hex16(const uint8_t* p) {
+  int32_t v = 0;
+  for (int i = 0; i != 4; ++i) {
+    uint8_t b = p[i];
+    uint8_t lower = b | 0x20;
+    if (b >= '0' && b <= '9') {
+      v = (v << 4) | (b - '0');
+    } else if (lower >= 'a' && lower <= 'f') {
+      v = (v << 4) | (lower - 'a' + 10);
+    } else {
+      return -1;
+    }
+  }
+  return v;
+}
+
+// Writes `cp` as UTF-8 to `dst`. Returns the number of bytes written (1-4).
+static inline size_t _jsont_encode_utf8(uint8_t* dst, uint32_t cp) {
+  if (cp < 0x80) {
+    dst[0] = (uint8_t)cp;
+    return 1;
+  } else if (cp < 0x800) {
+    dst[0] = (uint8_t)((cp >> 6) | 0xc0);
+    dst[1] = (uint8_t)((cp & 0x3f) | 0x80);
+    return 2;
+  } else if (cp < 0x10000) {
+    dst[0] = (uint8_t)((cp >> 12) | 0xe0);
+    dst[1] = (uint8_t)(((cp >> 6) & 0x3f) | 0x80);
+    dst[2] = (uint8_t)((cp & 0x3f) | 0x80);
+    return 3;
+  }
+  dst[0] = (uint8_t)((cp >> 18) | 0xf0);
+  dst[1] = (uint8_t)(((cp >> 12) & 0x3f) | 0x80);
+  dst[2] = (uint8_t)(((cp >> 6) & 0x3f) | 0x80);
+  dst[3] = (uint8_t)((cp & 0x3f) | 0x80);
+  return 4;
+}
+
+// Decodes the escape sequence following a backslash at `*p` into UTF-8 at
+// `dst` and advances `*p` past it. A UTF-16 surrogate pair written as two
+// "\uXXXX" sequences is combined. Lone surrogates and malformed "\u"
+// sequences are written as U+FFFD, and unknown escapes as the escaped byte.
+// Returns the number of bytes written (1-4), which is never more than read.
+static inline size_t _jsont_unescape_one(const uint8_t** p, const uint8_t* end,
+                                         uint8_t* dst) {
+  const uint8_t* q = *p;
+  uint8_t b = *q++;
+  *p = q;
+  switch (b) {
+    case 'b': *dst = '\b'; return 1;
+    case 'f': *dst = '\f'; return 1;
+    case 'n': *dst = '\n'; return 1;
+    case 'r': *dst = '\r'; return 1;
+    case 't': *dst = '\t'; return 1;
+    case 'u': break;
+    default: *dst = b; return 1;
+  }
+  int32_t cp = (end - q >= 4) ? _jsont_hex16(q) : -1;
+  if (cp < 0) {
+    return _jsont_encode_utf8(dst, 0xFFFD);
+  }
+  q += 4;
+  if (cp >= 0xD800 && cp <= 0xDBFF) {
+    int32_t lo;
+    if (end - q >= 6 && q[0] == '\\' && q[1] == 'u' &&
+        (lo = _jsont_hex16(q + 2)) >= 0xDC00 && lo <= 0xDFFF) {
+      cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+      q += 6;
+    } else {
+      cp = 0xFFFD;
+    }
+  } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+    cp = 0xFFFD;
+  }
+  *p = q;
+  return _jsont_encode_utf8(dst, (uint32_t)cp);
+}
+
+// Unescapes the JSON string content [p,end) into `dst`, which must have room
+// for `end - p` bytes. Returns the number of bytes written.
+static inline size_t _jsont_unescape(const uint8_t* p, const uint8_t* end,
+                                     uint8_t* dst) {
+  uint8_t* start = dst;
+  while (p != end) {
+    const uint8_t* bs = (const uint8_t*)memchr(p, '\\', end - p);
+    if (bs == 0 || bs + 1 == end) {
+      bs = end;
+    }
+    memcpy(dst, p, bs - p);
+    dst += bs - p;
+    if (bs == end) {
+      break;
+    }
+    p = bs + 1;
+    dst += _jsont_unescape_one(&p, end, dst);
+  }
+  return dst - start;
+}
+
+// True if the JSON string content [p,end) unescapes to `length` bytes at
+// `bytes`, decided without unescaping into a buffer
+static inline bool _jsont_unescaped_equals(const uint8_t* p, const uint8_t* end,
+                                           const uint8_t* bytes,
+                                           size_t length) {
+  const uint8_t* bytes_end = bytes + length;
+  while (p != end) {
+    const uint8_t* bs = (const uint8_t*)memchr(p, '\\', end - p);
+    if (bs == 0 || bs + 1 == end) {
+      bs = end;
+    }
+    size_t run = bs - p;
+    if ((size_t)(bytes_end - bytes) < run || memcmp(p, bytes, run) != 0) {
+      return false;
+    }
+    bytes += run;
+    if (bs == end) {
+      break;
+    }
+    p = bs + 1;
+    uint8_t utf8[4];
+    size_t n = _jsont_unescape_one(&p, end, utf8);
+    if ((size_t)(bytes_end - bytes) < n || memcmp(utf8, bytes, n) != 0) {
+      return false;
+    }
+    bytes += n;
+  }
+  return bytes == bytes_end;
+}
+
+// Maximum number of bytes needed to format a number, excluding any sentinel
+#define _JSONT_INT64_MAX_LENGTH  20 // -9223372036854775808
+#define _JSONT_DOUBLE_MAX_LENGTH 13 // -1.23457e-308
+
+static const char kDigitPairs[201] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536"
+  "37383940414243444546474849505152535455565758596061626364656667686970717273"
+  "7475767778798081828384858687888990919293949596979899";
+
+// Writes the decimal representation of `u` to `dst`, which must have room for
+// _JSONT_INT64_MAX_LENGTH bytes (UINT64_MAX is 20 digits as well.) Returns the
+// number of bytes written.
+static inline size_t _jsont_format_uint64(char* dst, uint64_t u) {
+  // Produce two digits at a time, from the end
+  char tmp[_JSONT_INT64_MAX_LENGTH];
+  char* p = tmp + sizeof(tmp);
+  while (u >= 100) {
+    const char* pair = kDigitPairs + ((u % 100) * 2);
+    u /= 100;
+    *--p = pair[1];
+    *--p = pair[0];
+  }
+  if (u >= 10) {
+    *--p = kDigitPairs[(u * 2) + 1];
+    *--p = kDigitPairs[u * 2];
+  } else {
+    *--p = (char)('0' + u);
+  }
+  size_t ndigits = tmp + sizeof(tmp) - p;
+  memcpy((void*)dst, (const void*)p, ndigits);
+  return ndigits;
+}
+
+// Writes the decimal representation of `v` to `dst`, which must have room for
+// _JSONT_INT64_MAX_LENGTH bytes. Returns the number of bytes written.
+static inline size_t _jsont_format_int64(char* dst, int64_t v) {
+  if (v < 0) {
+    dst[0] = '-';
+    return 1 + _jsont_format_uint64(dst + 1, 0 - (uint64_t)v);
+  }
+  return _jsont_format_uint64(dst, (uint64_t)v);
+}
+
+// ----------------- Scanner -----------------
+//
+// The tokenizer proper, shared by `jsont_next` and `jsont::Tokenizer::next`,
+// which only translate its tokens and errors. Its body is in jsont_scan_next.h,
+// and what it needs is here.
+
+// Dispatch on byte classes with computed gotos ("labels as values") where the
+// compiler supports them
+#ifndef _JSONT_COMPUTED_GOTO
+  #if defined(__GNUC__)
+    #define _JSONT_COMPUTED_GOTO 1
+  #else
+    #define _JSONT_COMPUTED_GOTO 0
+  #endif
+#endif
+
+#ifdef NAN
+  #define _JSONT_NAN NAN
+#else
+  #define _JSONT_NAN nan(0)
+#endif
+
+// The trusted scanner is inlined into its wrapper even though it's large, so
+// that the wrapper costs nothing
+#if defined(__GNUC__)
+  #define _JSONT_ALWAYS_INLINE inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+  #define _JSONT_ALWAYS_INLINE __forceinline
+#else
+  #define _JSONT_ALWAYS_INLINE inline
+#endif
+
+// Reasons for kScanTokenError, as stored in _jsont_scan_t.error
+enum {
+  kScanErrorNone = 0,
+  kScanErrorPrematureEnd,       // input ends inside an atom or escape sequence
+  kScanErrorUnterminatedString, // input ends inside a string
+  kScanErrorInvalidByte,
+  kScanErrorSyntax,             // e.g. two values without a comma between them
+  kScanErrorUnexpectedComma,
+  kScanErrorTrailingComma,
+  kScanErrorUnexpectedColon,
+  kScanErrorMalformedNumber,
+  kScanErrorMalformedUnicode,
+  kScanErrorUnexpectedObjectEnd,
+  kScanErrorUnexpectedArrayEnd,
+  kScanErrorTooDeep,
+};
+
+// What may follow the current token (_jsont_scan_t.state). A value may start
+// in the states up to kScanObjectValue, and a field name in kScanObjectFirst
+// and kScanObjectNext.
+enum {
+  kScanTop = 0,     // a value at depth 0
+  kScanArrayFirst,  // after "[": a value or "]"
+  kScanArrayNext,   // after "," in an array: a value
+  kScanObjectValue, // after a field name and ":": a value
+  kScanObjectFirst, // after "{": a field name or "}"
+  kScanObjectNext,  // after "," in an object: a field name
+  kScanArrayAfter,  // after a value in an array: "," or "]"
+  kScanObjectAfter, // after a value in an object: "," or "}"
+};
+
+static inline void _jsont_scan_reset(_jsont_scan_t* s, const uint8_t* bytes,
+                                     size_t length, bool padded) {
+  s->bytes = bytes;
+  s->length = length;
+  s->offset = 0;
+  s->start = 0;
+  s->value_offset = 0;
+  s->value_length = 0;
+  s->padded = padded;
+  s->value_escaped = false;
+  s->tok = kScanTokenEnd;
+  s->error = kScanErrorNone;
+  s->state = kScanTop;
+  s->after = kScanTop;
+  s->depth = 0;
+}
+
+// Enters an object or array. Returns false if that's nested too deep.
+static inline bool _jsont_scan_push(_jsont_scan_t* s, bool object) {
+  if (s->depth == _JSONT_MAX_DEPTH) {
+    return false;
+  }
+  uint64_t bit = (uint64_t)1 << (s->depth % 64);
+  if (object) {
+    s->stack[s->depth / 64] |= bit;
+    s->state = kScanObjectFirst;
+    s->after = kScanObjectAfter;
+  } else {
+    s->stack[s->depth / 64] &= ~bit;
+    s->state = kScanArrayFirst;
+    s->after = kScanArrayAfter;
+  }
+  ++s->depth;
+  return true;
+}
+
+// Leaves the innermost object or array, which the caller knows exists
+static inline void _jsont_scan_pop(_jsont_scan_t* s) {
+  size_t d = --s->depth;
+  if (d == 0) {
+    s->after = kScanTop;
+  } else {
+    --d;
+    s->after = ((s->stack[d / 64] >> (d % 64)) & 1) ? kScanObjectAfter
+                                                    : kScanArrayAfter;
+  }
+  s->state = s->after;
+}
+
+// Returns how many of the `max` bytes at `p` are before `end` and before any
+// NUL byte, which ends the input as `end` does
+static inline size_t _jsont_scan_avail(const uint8_t* p, const uint8_t* end,
+                                       size_t max) {
+  size_t n = ((size_t)(end - p) < max) ? (size_t)(end - p) : max;
+  const uint8_t* nul = (const uint8_t*)memchr((const void*)p, 0, n);
+  return (nul == 0) ? n : (size_t)(nul - p);
+}
+
+// Like the scanner in jsont_scan_next.h, for input known to be valid JSON:
+// atoms are recognized by their first byte, commas and number grammar are not
+// checked, and a NUL byte only ends the input between values. Nesting is still tracked so that the two can be
+// mixed. Malformed input yields unspecified tokens, but is never read past its
+// end. A switch, so that it can be inlined.
+static _JSONT_ALWAYS_INLINE uint8_t _jsont_scan_next_trusted(
+    _jsont_scan_t* s) {
+  const uint8_t* const bytes = s->bytes;
+  const uint8_t* const end = bytes + s->length;
+  const uint8_t* p = bytes + s->offset;
+  #define _JSONT_SCAN_TOKEN(token) \
+    do { s->offset = p - bytes; return s->tok = (token); } while (0)
+  #define _JSONT_SCAN_ATOM(len, token) do { \
+    s->start = (p - 1) - bytes; \
+    p = ((size_t)(end - p) < (len)) ? end : p + (len); \
+    s->state = s->after; \
+    _JSONT_SCAN_TOKEN(token); \
+  } while (0)
+
+  while (p != end) {
+    uint8_t b = *p++;
+    switch (b) {
+      case '{': case '[': {
+        s->start = (p - 1) - bytes;
+        if (!_jsont_scan_push(s, b == '{')) {
+          s->error = kScanErrorTooDeep;
+          _JSONT_SCAN_TOKEN(kScanTokenError);
+        }
+        _JSONT_SCAN_TOKEN(b == '{' ? kScanTokenObjectStart : kScanTokenArrayStart);
+      }
+      case '}': case ']': {
+        s->start = (p - 1) - bytes;
+        if (s->depth != 0) {
+          _jsont_scan_pop(s);
+        }
+        _JSONT_SCAN_TOKEN(b == '}' ? kScanTokenObjectEnd : kScanTokenArrayEnd);
+      }
+      case 'n': _JSONT_SCAN_ATOM(3, kScanTokenNull);
+      case 't': _JSONT_SCAN_ATOM(3, kScanTokenTrue);
+      case 'f': _JSONT_SCAN_ATOM(4, kScanTokenFalse);
+
+      case ' ': case '\t': case '\r': case '\n': case ',':
+        break;
+      case 0: {
+        --p;
+        s->start = p - bytes;
+        _JSONT_SCAN_TOKEN(kScanTokenEnd);
+      }
+
+      case '"': {
+        s->start = (p - 1) - bytes;
+        s->value_offset = p - bytes;
+        s->value_escaped = false;
+        b = 0;
+        while (p != end) {
+          p = s->padded ? _jsont_find_string_end_padded(p)
+                        : _jsont_find_string_end(p, end);
+          if (p == end) {
+            break;
+          }
+          b = *p++;
+          if (b == '"') {
+            break;
+          } else if (b == '\\') {
+            s->value_escaped = true;
+            if (p == end) {
+              break;
+            }
+            ++p;
+          }
+        }
+        s->value_length = (p - bytes) - s->value_offset - (b == '"');
+
+        // is this a field name?
+        while (p != end) {
+          switch (*p++) {
+            case ' ': case '\t': case '\r': case '\n': break;
+            case ':': {
+              s->state = kScanObjectValue;
+              _JSONT_SCAN_TOKEN(kScanTokenFieldName);
+            }
+            default: --p; goto after_string;
+          }
+        }
+        after_string:
+        s->state = s->after;
+        _JSONT_SCAN_TOKEN(kScanTokenString);
+      }
+
+      default: {
+        // We are reading a number
+        const uint8_t* number = p - 1;
+        uint8_t tok = kScanTokenInt;
+        for (; p != end; ++p) {
+          uint8_t byteClass = kByteClassTable[*p];
+          if (byteClass == kByteClassFloatMark) {
+            tok = kScanTokenFloat;
+          } else if (byteClass != kByteClassDigit &&
+                     byteClass != kByteClassSign) {
+            break;
+          }
+        }
+        s->start = s->value_offset = number - bytes;
+        s->value_length = p - number;
+        s->value_escaped = false;
+        s->state = s->after;
+        _JSONT_SCAN_TOKEN(tok);
+      }
+    }
+  }
+
+  #undef _JSONT_SCAN_ATOM
+  s->start = p - bytes;
+  _JSONT_SCAN_TOKEN(kScanTokenEnd);
+  #undef _JSONT_SCAN_TOKEN
+}
+
+// Parses the number in `length` bytes at `bytes`. A number of up to 19 digits
+// whose value and power of 10 are exact doubles is computed with one exact
+// multiplication or division, which is correctly rounded (Clinger's fast
+// path.) Other numbers go to strtod. Unless `terminated`, the number lies at
+// the edge of the input buffer without a sentinel byte after it and is copied
+// for strtod, which only happens for broken JSON, unescaped strings or when the
+// whole document is just a number.
+static inline double _jsont_parse_float(const char* bytes, size_t length,
+                                        bool terminated) {
+  #if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+  static const double kPow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+    1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+  };
+  const uint8_t* p = (const uint8_t*)bytes;
+  const uint8_t* end = p + length;
+  bool negative = (p != end && *p == '-');
+  p += negative;
+  const uint8_t* digits = p;
+  uint64_t m = 0;
+  int ndigits = 0;
+  int exp10 = 0;
+  for (; p != end && (uint8_t)(*p - '0') < 10; ++p, ++ndigits) {
+    m = m * 10 + (*p - '0');
+  }
+  bool valid = (p != digits);
+  if (valid && p != end && *p == '.') {
+    const uint8_t* fraction = ++p;
+    for (; p != end && (uint8_t)(*p - '0') < 10; ++p, ++ndigits) {
+      m = m * 10 + (*p - '0');
+    }
+    exp10 = -(int)(p - fraction);
+    valid = (p != fraction);
+  }
+  if (valid && p != end && (*p | 0x20) == 'e') {
+    bool negative_exp = (++p != end && *p == '-');
+    p += (p != end && (*p == '-' || *p == '+'));
+    const uint8_t* exponent = p;
+    int e = 0;
+    for (; p != end && (uint8_t)(*p - '0') < 10 && e < 1000; ++p) {
+      e = e * 10 + (*p - '0');
+    }
+    exp10 += negative_exp ? -e : e;
+    valid = (p != exponent);
+  }
+  if ( valid && p == end && ndigits <= 19 && m <= (1ULL << 53) &&
+       exp10 >= -22 && exp10 <= 22 ) {
+    double v = (double)m;
+    v = (exp10 < 0) ? v / kPow10[-exp10] : v * kPow10[exp10];
+    return negative ? -v : v;
+  }
+  #endif
+  if (!terminated) {
+    char buf[128];
+    if (length > 127) {
+      // We are unable to interpret such a large literal in this edge-case
+      return _JSONT_NAN;
+    }
+    memcpy((void*)buf, (const void*)bytes, length);
+    buf[length] = '\0';
+    return strtod((const char*)buf, (char**)0);
+  }
+  return strtod(bytes, (char**)0);
+}
+
+// Parses the integer in `length` bytes at `bytes`. Up to 18 digits can't
+// overflow and are read here, and anything else goes to strtoll.
+static inline int64_t _jsont_parse_int(const char* bytes, size_t length,
+                                       bool terminated) {
+  const uint8_t* p = (const uint8_t*)bytes;
+  const uint8_t* end = p + length;
+  bool negative = (p != end && *p == '-');
+  p += negative;
+  if (p != end && end - p <= 18) {
+    uint64_t v = 0;
+    for (; p != end && (uint8_t)(*p - '0') < 10; ++p) {
+      v = v * 10 + (*p - '0');
+    }
+    if (p == end) {
+      return negative ? -(int64_t)v : (int64_t)v;
+    }
+  }
+  if (!terminated) {
+    char buf[21];
+    if (length > 20) {
+      // We are unable to interpret such a large literal in this edge-case
+      return 0;
+    }
+    memcpy((void*)buf, (const void*)bytes, length);
+    buf[length] = '\0';
+    return strtoll((const char*)buf, (char**)0, 10);
+  }
+  return strtoll(bytes, (char**)0, 10);
+}
+
+#endif // JSONT_KERNELS_INCLUDED
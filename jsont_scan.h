@@ -0,0 +1,53 @@
+// JSON Tokenizer and builder. Copyright (c) 2012, Rasmus Andersson. All rights
+// reserved. Use of this source code is governed by a MIT-style license that can
+// be found in the LICENSE file.
+//
+// State of the scanner shared by the C and C++ tokenizers (jsont_scan_next.h
+// and jsont_kernels.h.) Internal, and kept apart from jsont.h so that jsont.hh
+// can embed the state without exposing the C API.
+#ifndef JSONT_SCAN_INCLUDED
+#define JSONT_SCAN_INCLUDED
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+// Maximum depth of nested objects and arrays (JSONT_MAX_DEPTH in jsont.h)
+#define _JSONT_MAX_DEPTH 512
+
+// Tokens returned by the scanner. These are the JSONT_* token types of jsont.h,
+// which jsont.c checks.
+enum {
+  kScanTokenEnd = 0,
+  kScanTokenError,
+  kScanTokenObjectStart,
+  kScanTokenObjectEnd,
+  kScanTokenArrayStart,
+  kScanTokenArrayEnd,
+  kScanTokenTrue,
+  kScanTokenFalse,
+  kScanTokenNull,
+  kScanTokenInt = kScanTokenNull + 2,
+  kScanTokenFloat,
+  kScanTokenString,
+  kScanTokenFieldName,
+};
+
+typedef struct {
+  const uint8_t* bytes;
+  size_t length;
+  size_t offset;       // of the next byte to read
+  size_t start;        // offset of the first byte of the current token
+  size_t value_offset; // of the current value (strings: after the quote)
+  size_t value_length;
+  bool padded;         // input is followed by JSONT_PADDING zero bytes
+  bool value_escaped;  // current value contains escape sequences
+  uint8_t tok;         // current token (kScanToken*)
+  uint8_t error;       // reason for the last kScanTokenError
+  uint8_t state;       // what may follow the current token
+  uint8_t after;       // state after a value at the current depth
+  uint16_t depth;
+  uint64_t stack[_JSONT_MAX_DEPTH / 64]; // bit set for each object
+} _jsont_scan_t;
+
+#endif // JSONT_SCAN_INCLUDED
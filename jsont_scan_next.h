@@ -0,0 +1,298 @@
+// JSON Tokenizer and builder. Copyright (c) 2012, Rasmus Andersson. All rights
+// reserved. Use of this source code is governed by a MIT-style license that can
+// be found in the LICENSE file.
+//
+// Body of the scanner shared by `jsont_next` and `jsont::Tokenizer::next`,
+// included inside each of them rather than being a function of its own, as
+// GCC and clang won't inline a function with a computed goto. Internal, and
+// included after jsont_kernels.h.
+//
+// The includer has `_jsont_scan_t* s` in scope and defines
+// `_JSONT_SCAN_RETURN(token)` to return `token`, a kScanToken* which is also
+// stored in `s->tok`. On kScanTokenError, `s->error` tells why and `s->offset`
+// is just past the offending byte. A NUL byte ends the input as `s->length`
+// does, other than in a value scanned by _jsont_scan_next_trusted. Input ending
+// inside a token is an error; inside an unclosed object or array it is not, so
+// that a stream can be read piecewise, and neither are several values at
+// depth 0.
+{
+  //
+  // { } [ ] n t f "
+  //         | | | |
+  //         | | | +- /[^"]*/ "
+  //         | | +- a l s e
+  //         | +- r u e
+  //         +- u l l
+  //
+  // Each byte is dispatched on its class in kByteClassTable. With
+  // _JSONT_COMPUTED_GOTO, that's a computed goto from the end of every case
+  // which consumes bytes without producing a token (whitespace and commas),
+  // giving each its own branch history, and otherwise a switch.
+  //
+  // The read position is kept in the local `p` so that the compiler can keep
+  // it in a register, and is stored back before returning.
+  const uint8_t* const bytes = s->bytes;
+  const uint8_t* const end = bytes + s->length;
+  const uint8_t* p = bytes + s->offset;
+  uint8_t b;
+  #define _JSONT_SCAN_TOKEN(token) do { \
+    s->offset = p - bytes; \
+    s->tok = (token); \
+    _JSONT_SCAN_RETURN(token); \
+  } while (0)
+  #define _JSONT_SCAN_ERROR(code) do { \
+    s->error = (code); \
+    _JSONT_SCAN_TOKEN(kScanTokenError); \
+  } while (0)
+  // The last 4 bytes of an atom of `len` bytes after its first, e.g. "null"
+  // for the "ull" of "null", are compared as one word
+  #define _JSONT_SCAN_ATOM(tail, len, token) do { \
+    s->start = (p - 1) - bytes; \
+    if (s->state > kScanObjectValue) { \
+      _JSONT_SCAN_ERROR(kScanErrorSyntax); \
+    } else if ((size_t)(end - p) < (len) || \
+               _jsont_load32(p + (len) - 4) != \
+               _jsont_load32((const uint8_t*)(tail))) { \
+      _JSONT_SCAN_ERROR(_jsont_scan_avail(p, end, (len)) < (len) \
+                        ? kScanErrorPrematureEnd : kScanErrorInvalidByte); \
+    } \
+    p += (len); \
+    s->state = s->after; \
+    _JSONT_SCAN_TOKEN(token); \
+  } while (0)
+
+  #if _JSONT_COMPUTED_GOTO
+  static const void* const kDispatch[] = {
+    &&scan_invalid, &&scan_space, &&scan_object_start, &&scan_object_end,
+    &&scan_array_start, &&scan_array_end, &&scan_quote, &&scan_comma,
+    &&scan_colon, &&scan_number, &&scan_number /* sign */,
+    &&scan_invalid /* float mark */, &&scan_null, &&scan_true, &&scan_false,
+  };
+  #define _JSONT_SCAN_CASE(label, byteClass) label
+  #define _JSONT_SCAN_DISPATCH() do { \
+    if (p == end) { goto scan_end; } \
+    b = *p++; \
+    goto *kDispatch[kByteClassTable[b]]; \
+  } while (0)
+  _JSONT_SCAN_DISPATCH();
+  { { // as for the while and switch below
+  #else
+  #define _JSONT_SCAN_CASE(label, byteClass) case byteClass
+  #define _JSONT_SCAN_DISPATCH() continue
+  while (p != end) {
+    b = *p++;
+    switch (kByteClassTable[b]) {
+  #endif
+
+      _JSONT_SCAN_CASE(scan_object_start, kByteClassObjectStart): {
+        s->start = (p - 1) - bytes;
+        if (s->state > kScanObjectValue) {
+          _JSONT_SCAN_ERROR(kScanErrorSyntax);
+        } else if (!_jsont_scan_push(s, true)) {
+          _JSONT_SCAN_ERROR(kScanErrorTooDeep);
+        }
+        _JSONT_SCAN_TOKEN(kScanTokenObjectStart);
+      }
+      _JSONT_SCAN_CASE(scan_object_end, kByteClassObjectEnd): {
+        s->start = (p - 1) - bytes;
+        if (s->state == kScanObjectFirst || s->state == kScanObjectAfter) {
+          _jsont_scan_pop(s);
+          _JSONT_SCAN_TOKEN(kScanTokenObjectEnd);
+        }
+        _JSONT_SCAN_ERROR(s->state == kScanObjectNext ? kScanErrorTrailingComma
+                        : s->state == kScanObjectValue ? kScanErrorSyntax
+                        : kScanErrorUnexpectedObjectEnd);
+      }
+
+      _JSONT_SCAN_CASE(scan_array_start, kByteClassArrayStart): {
+        s->start = (p - 1) - bytes;
+        if (s->state > kScanObjectValue) {
+          _JSONT_SCAN_ERROR(kScanErrorSyntax);
+        } else if (!_jsont_scan_push(s, false)) {
+          _JSONT_SCAN_ERROR(kScanErrorTooDeep);
+        }
+        _JSONT_SCAN_TOKEN(kScanTokenArrayStart);
+      }
+      _JSONT_SCAN_CASE(scan_array_end, kByteClassArrayEnd): {
+        s->start = (p - 1) - bytes;
+        if (s->state == kScanArrayFirst || s->state == kScanArrayAfter) {
+          _jsont_scan_pop(s);
+          _JSONT_SCAN_TOKEN(kScanTokenArrayEnd);
+        }
+        _JSONT_SCAN_ERROR(s->state == kScanArrayNext ? kScanErrorTrailingComma
+                        : kScanErrorUnexpectedArrayEnd);
+      }
+
+      _JSONT_SCAN_CASE(scan_null, kByteClassNull):
+        _JSONT_SCAN_ATOM("null", 3, kScanTokenNull);
+      _JSONT_SCAN_CASE(scan_true, kByteClassTrue):
+        _JSONT_SCAN_ATOM("true", 3, kScanTokenTrue);
+      _JSONT_SCAN_CASE(scan_false, kByteClassFalse):
+        _JSONT_SCAN_ATOM("alse", 4, kScanTokenFalse);
+
+      _JSONT_SCAN_CASE(scan_space, kByteClassSpace): // IETF RFC4627
+        _JSONT_SCAN_DISPATCH();
+
+      _JSONT_SCAN_CASE(scan_comma, kByteClassComma): {
+        if (s->state == kScanArrayAfter) {
+          s->state = kScanArrayNext;
+        } else if (s->state == kScanObjectAfter) {
+          s->state = kScanObjectNext;
+        } else {
+          _JSONT_SCAN_ERROR(kScanErrorUnexpectedComma);
+        }
+        _JSONT_SCAN_DISPATCH();
+      }
+
+      _JSONT_SCAN_CASE(scan_colon, kByteClassColon): // only after a field name
+        _JSONT_SCAN_ERROR(kScanErrorUnexpectedColon);
+
+      _JSONT_SCAN_CASE(scan_quote, kByteClassQuote): {
+        s->start = (p - 1) - bytes;
+        if (s->state > kScanObjectNext) {
+          _JSONT_SCAN_ERROR(kScanErrorSyntax);
+        }
+        s->value_offset = p - bytes;
+        s->value_escaped = false;
+
+        // Find the end of the string, only checking escape sequences. Any
+        // unescaping is done when the value is read.
+        b = 0;
+        while (p != end) {
+          // Skip a block at a time to the next quote, backslash or NUL, which
+          // with padding is at the latest the padding at the end of the input
+          p = s->padded ? _jsont_find_string_end_padded(p)
+                        : _jsont_find_string_end(p, end);
+          if (p == end) {
+            break;
+          }
+          b = *p++;
+          if (b == '"') {
+            break;
+          } else if (b == '\\') {
+            s->value_escaped = true;
+            if (p == end || *p == 0) {
+              _JSONT_SCAN_ERROR(kScanErrorPrematureEnd);
+            }
+            if (*p++ == 'u') {
+              // 4 hex digits should follow, and a lead surrogate must be
+              // followed by a "\u" trail surrogate
+              if (_jsont_scan_avail(p, end, 4) < 4) {
+                _JSONT_SCAN_ERROR(kScanErrorPrematureEnd);
+              }
+              int32_t cp = _jsont_hex16(p);
+              if (cp >= 0xd800 && cp <= 0xdbff) {
+                // The input may end inside the trail surrogate, which is
+                // completed with the rest of "\udc00" to check what's there
+                uint8_t trail[6] = {'\\', 'u', 'd', 'c', '0', '0'};
+                size_t n = _jsont_scan_avail(p + 4, end, 6);
+                memcpy(trail, p + 4, n);
+                int32_t lo = (trail[0] == '\\' && trail[1] == 'u')
+                           ? _jsont_hex16(trail + 2) : -1;
+                if (lo < 0xdc00 || lo > 0xdfff) {
+                  cp = -1;
+                } else if (n < 6) {
+                  _JSONT_SCAN_ERROR(kScanErrorPrematureEnd);
+                } else {
+                  p += 6; // the pair is read as one
+                }
+              } else if (cp >= 0xdc00 && cp <= 0xdfff) {
+                cp = -1; // a trail surrogate without a lead one
+              }
+              if (cp < 0) {
+                _JSONT_SCAN_ERROR(kScanErrorMalformedUnicode);
+              }
+              p += 4;
+            }
+          } else {
+            --p; // a NUL, which ends the input
+            break;
+          }
+        }
+        if (b != '"') {
+          _JSONT_SCAN_ERROR(kScanErrorUnterminatedString);
+        }
+        s->value_length = (p - bytes) - s->value_offset - 1;
+
+        if (s->state <= kScanObjectValue) {
+          s->state = s->after;
+          _JSONT_SCAN_TOKEN(kScanTokenString);
+        }
+        // A field name, which must be followed by a colon
+        while (p != end) {
+          b = *p++;
+          switch (kByteClassTable[b]) {
+            case kByteClassSpace: break;
+            case kByteClassColon: {
+              s->state = kScanObjectValue;
+              _JSONT_SCAN_TOKEN(kScanTokenFieldName);
+            }
+            default: {
+              _JSONT_SCAN_ERROR(b == 0 ? kScanErrorPrematureEnd
+                                       : kScanErrorSyntax);
+            }
+          }
+        }
+        _JSONT_SCAN_ERROR(kScanErrorPrematureEnd);
+      }
+
+      #if !_JSONT_COMPUTED_GOTO
+      case kByteClassSign:
+      #endif
+      _JSONT_SCAN_CASE(scan_number, kByteClassDigit): {
+        const uint8_t* number = p - 1;
+        s->start = number - bytes;
+        if (s->state > kScanObjectValue) {
+          _JSONT_SCAN_ERROR(kScanErrorSyntax);
+        }
+        uint8_t tok = kScanTokenInt;
+        for (; p != end; ++p) {
+          uint8_t byteClass = kByteClassTable[*p];
+          if (byteClass == kByteClassDigit) {
+            continue;
+          } else if (byteClass == kByteClassFloatMark) {
+            tok = kScanTokenFloat;
+          } else if (byteClass == kByteClassSign) {
+            // a sign is only valid after an exponent marker
+            if ((p[-1] | 0x20) != 'e') {
+              _JSONT_SCAN_ERROR(kScanErrorMalformedNumber);
+            }
+          } else {
+            break;
+          }
+        }
+        if (p - number == 1 && kByteClassTable[*number] == kByteClassSign) {
+          _JSONT_SCAN_ERROR(kScanErrorMalformedNumber);
+        }
+        s->value_offset = s->start;
+        s->value_length = p - number;
+        s->value_escaped = false;
+        s->state = s->after;
+        _JSONT_SCAN_TOKEN(tok);
+      }
+
+      #if !_JSONT_COMPUTED_GOTO
+      default: // kByteClassFloatMark
+      #endif
+      _JSONT_SCAN_CASE(scan_invalid, kByteClassInvalid):
+        s->start = (p - 1) - bytes;
+        if (b == 0) {
+          // Stays at the NUL, so that reading on keeps returning the end
+          --p;
+          _JSONT_SCAN_TOKEN(kScanTokenEnd);
+        }
+        _JSONT_SCAN_ERROR(kScanErrorInvalidByte);
+    }
+  }
+
+  #if _JSONT_COMPUTED_GOTO
+  scan_end:
+  #endif
+  s->start = p - bytes;
+  _JSONT_SCAN_TOKEN(kScanTokenEnd);
+  #undef _JSONT_SCAN_CASE
+  #undef _JSONT_SCAN_DISPATCH
+  #undef _JSONT_SCAN_ATOM
+  #undef _JSONT_SCAN_TOKEN
+  #undef _JSONT_SCAN_ERROR
+}
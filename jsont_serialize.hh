@@ -0,0 +1,254 @@
+// JSON serialization of structs described once with a macro. Copyright (c)
+// 2012, Rasmus Andersson. All rights reserved. Use of this source code is
+// governed by a MIT-style license that can be found in the LICENSE file.
+#ifndef JSONT_SERIALIZE_INCLUDED
+#define JSONT_SERIALIZE_INCLUDED
+
+#include "jsont.hh"
+#include <map>
+#if __cplusplus >= 201703L
+  #include <optional>
+#endif
+
+// Describe the members of struct `T` to be serialized, in order:
+//
+//   namespace app {
+//   struct Point { int x, y; std::vector<std::string> tags; };
+//   JSONT_MEMBERS(Point, x, y, tags)
+//   }
+//
+// Place it in the namespace of `T`, so that `jsont::serialize` finds it.
+// Members may be numbers, bools, strings, pointers, std::vector, std::map
+// with string keys, std::optional (C++17) or other described structs. Up to
+// 32 members are supported.
+#define JSONT_MEMBERS(T, ...) \
+  inline void jsont_serialize(::jsont::Builder& b, const T& v) { \
+    b.startObject(); \
+    _JSONT_FOR_EACH(_JSONT_SERIALIZE_MEMBER, __VA_ARGS__) \
+    b.endObject(); \
+  } \
+  inline size_t jsont_estimate_size(const T& v) { \
+    return 2 _JSONT_FOR_EACH(_JSONT_ESTIMATE_MEMBER, __VA_ARGS__); \
+  }
+
+namespace jsont {
+
+// Add `v` to `builder`, after making room for its estimated size
+template <typename T> Builder& serialize(Builder& builder, const T& v);
+
+// Estimated number of bytes `v` serializes to. Exact for anything but strings
+// needing escapes and numbers, for which the maximum length is assumed.
+template <typename T> size_t estimateSize(const T& v);
+
+// Add `v` to `builder` as a value
+inline void serializeValue(Builder& b, bool v);
+inline void serializeValue(Builder& b, short v);
+inline void serializeValue(Builder& b, unsigned short v);
+inline void serializeValue(Builder& b, int v);
+inline void serializeValue(Builder& b, unsigned int v);
+inline void serializeValue(Builder& b, long v);
+inline void serializeValue(Builder& b, unsigned long v);
+inline void serializeValue(Builder& b, long long v);
+inline void serializeValue(Builder& b, unsigned long long v);
+inline void serializeValue(Builder& b, float v);
+inline void serializeValue(Builder& b, double v);
+inline void serializeValue(Builder& b, const char* v);
+inline void serializeValue(Builder& b, const std::string& v);
+template <typename T> void serializeValue(Builder& b, const T* v);
+template <typename T, typename A>
+void serializeValue(Builder& b, const std::vector<T, A>& v);
+template <typename T, typename C, typename A>
+void serializeValue(Builder& b, const std::map<std::string, T, C, A>& v);
+#if __cplusplus >= 201703L
+template <typename T> void serializeValue(Builder& b, const std::optional<T>& v);
+#endif
+template <typename T> void serializeValue(Builder& b, const T& v);
+
+inline size_t estimateValueSize(bool v);
+inline size_t estimateValueSize(short v);
+inline size_t estimateValueSize(unsigned short v);
+inline size_t estimateValueSize(int v);
+inline size_t estimateValueSize(unsigned int v);
+inline size_t estimateValueSize(long v);
+inline size_t estimateValueSize(unsigned long v);
+inline size_t estimateValueSize(long long v);
+inline size_t estimateValueSize(unsigned long long v);
+inline size_t estimateValueSize(float v);
+inline size_t estimateValueSize(double v);
+inline size_t estimateValueSize(const char* v);
+inline size_t estimateValueSize(const std::string& v);
+template <typename T> size_t estimateValueSize(const T* v);
+template <typename T, typename A>
+size_t estimateValueSize(const std::vector<T, A>& v);
+template <typename T, typename C, typename A>
+size_t estimateValueSize(const std::map<std::string, T, C, A>& v);
+#if __cplusplus >= 201703L
+template <typename T> size_t estimateValueSize(const std::optional<T>& v);
+#endif
+template <typename T> size_t estimateValueSize(const T& v);
+
+
+// ------------------- internal ---------------------
+
+// Maximum lengths of formatted numbers, as written by Builder
+#define _JSONT_INT_ESTIMATE    20 // -9223372036854775808
+#define _JSONT_DOUBLE_ESTIMATE 13 // -1.23457e-308
+
+#define _JSONT_SERIALIZE_MEMBER(m) { \
+    static const ::jsont::Key k(#m); \
+    b.field(k); \
+    ::jsont::serializeValue(b, v.m); \
+  }
+// key, quotes, colon and a comma
+#define _JSONT_ESTIMATE_MEMBER(m) \
+  + (sizeof(#m) + 3) + ::jsont::estimateValueSize(v.m)
+
+#define _JSONT_CAT(a, b) _JSONT_CAT_(a, b)
+#define _JSONT_CAT_(a, b) a##b
+#define _JSONT_NARGS(...) _JSONT_NARGS_(__VA_ARGS__, \
+  32,31,30,29,28,27,26,25,24,23,22,21,20,19,18,17, \
+  16,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1)
+#define _JSONT_NARGS_( \
+  _1,_2,_3,_4,_5,_6,_7,_8,_9,_10,_11,_12,_13,_14,_15,_16, \
+  _17,_18,_19,_20,_21,_22,_23,_24,_25,_26,_27,_28,_29,_30,_31,_32, N, ...) N
+#define _JSONT_FOR_EACH(M, ...) \
+  _JSONT_CAT(_JSONT_FE_, _JSONT_NARGS(__VA_ARGS__))(M, __VA_ARGS__)
+#define _JSONT_FE_1(M, a) M(a)
+#define _JSONT_FE_2(M, a, ...) M(a) _JSONT_FE_1(M, __VA_ARGS__)
+#define _JSONT_FE_3(M, a, ...) M(a) _JSONT_FE_2(M, __VA_ARGS__)
+#define _JSONT_FE_4(M, a, ...) M(a) _JSONT_FE_3(M, __VA_ARGS__)
+#define _JSONT_FE_5(M, a, ...) M(a) _JSONT_FE_4(M, __VA_ARGS__)
+#define _JSONT_FE_6(M, a, ...) M(a) _JSONT_FE_5(M, __VA_ARGS__)
+#define _JSONT_FE_7(M, a, ...) M(a) _JSONT_FE_6(M, __VA_ARGS__)
+#define _JSONT_FE_8(M, a, ...) M(a) _JSONT_FE_7(M, __VA_ARGS__)
+#define _JSONT_FE_9(M, a, ...) M(a) _JSONT_FE_8(M, __VA_ARGS__)
+#define _JSONT_FE_10(M, a, ...) M(a) _JSONT_FE_9(M, __VA_ARGS__)
+#define _JSONT_FE_11(M, a, ...) M(a) _JSONT_FE_10(M, __VA_ARGS__)
+#define _JSONT_FE_12(M, a, ...) M(a) _JSONT_FE_11(M, __VA_ARGS__)
+#define _JSONT_FE_13(M, a, ...) M(a) _JSONT_FE_12(M, __VA_ARGS__)
+#define _JSONT_FE_14(M, a, ...) M(a) _JSONT_FE_13(M, __VA_ARGS__)
+#define _JSONT_FE_15(M, a, ...) M(a) _JSONT_FE_14(M, __VA_ARGS__)
+#define _JSONT_FE_16(M, a, ...) M(a) _JSONT_FE_15(M, __VA_ARGS__)
+#define _JSONT_FE_17(M, a, ...) M(a) _JSONT_FE_16(M, __VA_ARGS__)
+#define _JSONT_FE_18(M, a, ...) M(a) _JSONT_FE_17(M, __VA_ARGS__)
+#define _JSONT_FE_19(M, a, ...) M(a) _JSONT_FE_18(M, __VA_ARGS__)
+#define _JSONT_FE_20(M, a, ...) M(a) _JSONT_FE_19(M, __VA_ARGS__)
+#define _JSONT_FE_21(M, a, ...) M(a) _JSONT_FE_20(M, __VA_ARGS__)
+#define _JSONT_FE_22(M, a, ...) M(a) _JSONT_FE_21(M, __VA_ARGS__)
+#define _JSONT_FE_23(M, a, ...) M(a) _JSONT_FE_22(M, __VA_ARGS__)
+#define _JSONT_FE_24(M, a, ...) M(a) _JSONT_FE_23(M, __VA_ARGS__)
+#define _JSONT_FE_25(M, a, ...) M(a) _JSONT_FE_24(M, __VA_ARGS__)
+#define _JSONT_FE_26(M, a, ...) M(a) _JSONT_FE_25(M, __VA_ARGS__)
+#define _JSONT_FE_27(M, a, ...) M(a) _JSONT_FE_26(M, __VA_ARGS__)
+#define _JSONT_FE_28(M, a, ...) M(a) _JSONT_FE_27(M, __VA_ARGS__)
+#define _JSONT_FE_29(M, a, ...) M(a) _JSONT_FE_28(M, __VA_ARGS__)
+#define _JSONT_FE_30(M, a, ...) M(a) _JSONT_FE_29(M, __VA_ARGS__)
+#define _JSONT_FE_31(M, a, ...) M(a) _JSONT_FE_30(M, __VA_ARGS__)
+#define _JSONT_FE_32(M, a, ...) M(a) _JSONT_FE_31(M, __VA_ARGS__)
+
+template <typename T> Builder& serialize(Builder& builder, const T& v) {
+  builder.sizeHint(estimateValueSize(v));
+  serializeValue(builder, v);
+  return builder;
+}
+template <typename T> size_t estimateSize(const T& v) {
+  return estimateValueSize(v);
+}
+
+inline void serializeValue(Builder& b, bool v) { b.value(v); }
+inline void serializeValue(Builder& b, short v) { b.value((int)v); }
+inline void serializeValue(Builder& b, unsigned short v) { b.value((int)v); }
+inline void serializeValue(Builder& b, int v) { b.value(v); }
+inline void serializeValue(Builder& b, unsigned int v) { b.value(v); }
+inline void serializeValue(Builder& b, long v) { b.value(v); }
+inline void serializeValue(Builder& b, unsigned long v) { b.value(v); }
+inline void serializeValue(Builder& b, long long v) { b.value(v); }
+inline void serializeValue(Builder& b, unsigned long long v) { b.value(v); }
+inline void serializeValue(Builder& b, float v) { b.value((double)v); }
+inline void serializeValue(Builder& b, double v) { b.value(v); }
+inline void serializeValue(Builder& b, const char* v) {
+  if (v) { b.value(v); } else { b.nullValue(); }
+}
+inline void serializeValue(Builder& b, const std::string& v) { b.value(v); }
+template <typename T> void serializeValue(Builder& b, const T* v) {
+  if (v) { serializeValue(b, *v); } else { b.nullValue(); }
+}
+template <typename T, typename A>
+void serializeValue(Builder& b, const std::vector<T, A>& v) {
+  b.startArray();
+  for (typename std::vector<T, A>::const_iterator it = v.begin();
+       it != v.end(); ++it) {
+    serializeValue(b, *it);
+  }
+  b.endArray();
+}
+template <typename T, typename C, typename A>
+void serializeValue(Builder& b, const std::map<std::string, T, C, A>& v) {
+  b.startObject();
+  for (typename std::map<std::string, T, C, A>::const_iterator it = v.begin();
+       it != v.end(); ++it) {
+    b.fieldName(it->first);
+    serializeValue(b, it->second);
+  }
+  b.endObject();
+}
+#if __cplusplus >= 201703L
+template <typename T> void serializeValue(Builder& b, const std::optional<T>& v) {
+  if (v) { serializeValue(b, *v); } else { b.nullValue(); }
+}
+#endif
+// Structs described with JSONT_MEMBERS
+template <typename T> void serializeValue(Builder& b, const T& v) {
+  jsont_serialize(b, v);
+}
+
+inline size_t estimateValueSize(bool v) { return v ? 4 : 5; }
+inline size_t estimateValueSize(short) { return _JSONT_INT_ESTIMATE; }
+inline size_t estimateValueSize(unsigned short) { return _JSONT_INT_ESTIMATE; }
+inline size_t estimateValueSize(int) { return _JSONT_INT_ESTIMATE; }
+inline size_t estimateValueSize(unsigned int) { return _JSONT_INT_ESTIMATE; }
+inline size_t estimateValueSize(long) { return _JSONT_INT_ESTIMATE; }
+inline size_t estimateValueSize(unsigned long) { return _JSONT_INT_ESTIMATE; }
+inline size_t estimateValueSize(long long) { return _JSONT_INT_ESTIMATE; }
+inline size_t estimateValueSize(unsigned long long) {
+  return _JSONT_INT_ESTIMATE;
+}
+inline size_t estimateValueSize(float) { return _JSONT_DOUBLE_ESTIMATE; }
+inline size_t estimateValueSize(double) { return _JSONT_DOUBLE_ESTIMATE; }
+inline size_t estimateValueSize(const char* v) {
+  return v ? strlen(v) + 2 : 4;
+}
+inline size_t estimateValueSize(const std::string& v) { return v.size() + 2; }
+template <typename T> size_t estimateValueSize(const T* v) {
+  return v ? estimateValueSize(*v) : 4;
+}
+template <typename T, typename A>
+size_t estimateValueSize(const std::vector<T, A>& v) {
+  size_t size = 2 + v.size(); // brackets and commas
+  for (typename std::vector<T, A>::const_iterator it = v.begin();
+       it != v.end(); ++it) {
+    size += estimateValueSize(*it);
+  }
+  return size;
+}
+template <typename T, typename C, typename A>
+size_t estimateValueSize(const std::map<std::string, T, C, A>& v) {
+  size_t size = 2;
+  for (typename std::map<std::string, T, C, A>::const_iterator it = v.begin();
+       it != v.end(); ++it) {
+    size += it->first.size() + 4 + estimateValueSize(it->second);
+  }
+  return size;
+}
+#if __cplusplus >= 201703L
+template <typename T> size_t estimateValueSize(const std::optional<T>& v) {
+  return v ? estimateValueSize(*v) : 4;
+}
+#endif
+template <typename T> size_t estimateValueSize(const T& v) {
+  return jsont_estimate_size(v);
+}
+
+} // namespace jsont
+
+#endif // JSONT_SERIALIZE_INCLUDED
@@ -0,0 +1,103 @@
+#include <jsont.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#define JSONT_ASSERT_BYTES(b, expected) do { \
+  size_t length = 0; \
+  const uint8_t* bytes = jsont_builder_bytes(b, &length); \
+  assert(length == strlen(expected)); \
+  assert(memcmp(bytes, expected, length) == 0); \
+} while(0)
+
+// Collects flushed output
+static char flushed[256];
+static size_t flushed_size = 0;
+static bool flush_to_array(jsont_builder_t* b, const uint8_t* bytes,
+                           size_t length) {
+  assert(jsont_builder_user_data(b) == (void*)flushed);
+  if (flushed_size + length > sizeof(flushed)) {
+    return false;
+  }
+  memcpy(flushed + flushed_size, bytes, length);
+  flushed_size += length;
+  return true;
+}
+
+static void build_document(jsont_builder_t* b) {
+  assert(jsont_builder_object_start(b));
+  assert(jsont_builder_field_str(b, "\"fo\"o"));
+  assert(jsont_builder_str(b, "Foo\n\t\x01"));
+  assert(jsont_builder_field_str(b, "n"));
+  assert(jsont_builder_int(b, -9223372036854775807LL - 1));
+  assert(jsont_builder_field_str(b, "x"));
+  assert(jsont_builder_double(b, 12.5));
+  assert(jsont_builder_field_str(b, "list"));
+  assert(jsont_builder_array_start(b));
+  assert(jsont_builder_null(b));
+  assert(jsont_builder_bool(b, true));
+  assert(jsont_builder_bool(b, false));
+  assert(jsont_builder_str(b, "\xe2\x86\x92"));
+  assert(jsont_builder_raw(b, (const uint8_t*)"{\"a\":[]}", 8));
+  assert(jsont_builder_array_start(b));
+  assert(jsont_builder_array_end(b));
+  assert(jsont_builder_array_end(b));
+  assert(jsont_builder_object_end(b));
+}
+
+static const char* kExpected =
+  "{\"\\\"fo\\\"o\":\"Foo\\n\\t\\u0001\","
+  "\"n\":-9223372036854775808,"
+  "\"x\":12.5,"
+  "\"list\":[null,true,false,\"\xe2\x86\x92\",{\"a\":[]},[]]}";
+
+int main(int argc, const char** argv) {
+  // Heap buffer
+  jsont_builder_t* b = jsont_builder_create((void*)flushed);
+  build_document(b);
+  JSONT_ASSERT_BYTES(b, kExpected);
+  assert(jsont_builder_error_info(b) == 0);
+
+  // The output can be read back by the tokenizer
+  size_t length = 0;
+  const uint8_t* bytes = jsont_builder_bytes(b, &length);
+  jsont_ctx_t* S = jsont_create(0);
+  jsont_reset(S, bytes, length);
+  jsont_tok_t tok;
+  while ((tok = jsont_next(S)) != JSONT_END) {
+    assert(tok != JSONT_ERR);
+    if (tok == JSONT_FIELD_NAME && jsont_str_equals(S, "n")) {
+      assert(jsont_next(S) == JSONT_NUMBER_INT);
+      assert(jsont_int_value(S) == -9223372036854775807LL - 1);
+    }
+  }
+  jsont_destroy(S);
+
+  // Reuse
+  jsont_builder_reset(b);
+  assert(jsont_builder_bytes(b, &length) == 0 && length == 0);
+  assert(jsont_builder_int(b, 0));
+  JSONT_ASSERT_BYTES(b, "0");
+
+  // A small caller-provided buffer without flush function fails when full
+  uint8_t buf[16];
+  jsont_builder_set_buffer(b, buf, sizeof(buf));
+  assert(jsont_builder_str(b, "0123456789"));
+  assert(jsont_builder_str(b, "0123456789") == false);
+  assert(jsont_builder_error_info(b) != 0);
+  // ...and remains failed
+  assert(jsont_builder_null(b) == false);
+
+  // A small caller-provided buffer which is flushed when full
+  jsont_builder_reset(b);
+  jsont_builder_set_flush(b, flush_to_array);
+  build_document(b);
+  assert(jsont_builder_flush(b));
+  assert(jsont_builder_bytes(b, &length) == 0);
+  assert(flushed_size == strlen(kExpected));
+  assert(memcmp(flushed, kExpected, flushed_size) == 0);
+
+  jsont_builder_destroy(b);
+  printf("PASS\n");
+  return 0;
+}
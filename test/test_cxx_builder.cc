@@ -0,0 +1,527 @@
+#include <jsont.hh>
+#include <jsont_serialize.hh>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/uio.h>
+
+using namespace jsont;
+
+namespace app {
+struct Point { int x, y; };
+JSONT_MEMBERS(Point, x, y)
+struct Shape {
+  std::string name; double area; bool filled; long long id;
+  std::vector<Point> points; std::map<std::string, std::vector<int> > tags;
+  const Point* origin; std::optional<std::string> note;
+  std::optional<Point> center; const char* label; unsigned int n;
+};
+JSONT_MEMBERS(Shape, name, area, filled, id, points, tags, origin, note, center,
+              label, n)
+struct Sizes {
+  short s; unsigned short us; unsigned long ul; unsigned long long ull;
+  int64_t i64; uint64_t u64; size_t z;
+};
+JSONT_MEMBERS(Sizes, s, us, ul, ull, i64, u64, z)
+} // namespace app
+
+static void test_indentation() {
+  Builder b;
+  b.setIndentation(Builder::SpaceIndentation, 2);
+  b.startObject().fieldName("a").value(1).fieldName("e").startArray()
+   .endArray().fieldName("o").startObject().fieldName("x").startArray()
+   .value(true).nullValue().startObject().endObject().endArray().endObject()
+   .endObject();
+  assert(b.toString() ==
+    "{\n"
+    "  \"a\": 1,\n"
+    "  \"e\": [],\n"
+    "  \"o\": {\n"
+    "    \"x\": [\n"
+    "      true,\n"
+    "      null,\n"
+    "      {}\n"
+    "    ]\n"
+    "  }\n"
+    "}");
+
+  Builder t;
+  t.setIndentation(Builder::TabIndentation, 1);
+  t.startArray().startArray().value(1).value(2).endArray().endArray();
+  assert(t.toString() == "[\n\t[\n\t\t1,\n\t\t2\n\t]\n]");
+
+  // No indentation by default
+  Builder c;
+  c.startObject().fieldName("a").startArray().value(1).value(2).endArray()
+   .endObject();
+  assert(c.toString() == "{\"a\":[1,2]}");
+}
+
+static void test_key() {
+  static const Key kA("a"), kQ(std::string("q\"\n"));
+  Builder b;
+  b.startObject().field(kA).value(1).field(kQ).startArray().value(2).endArray()
+   .endObject();
+  assert(b.toString() == "{\"a\":1,\"q\\\"\\n\":[2]}");
+  b.reset();
+  b.setIndentation(Builder::SpaceIndentation, 2);
+  b.startObject().field(kA).value(1).endObject();
+  assert(b.toString() == "{\n  \"a\": 1\n}");
+}
+
+static void test_external_buffer() {
+  char buf[16];
+  Builder b(buf, sizeof(buf));
+  b.startArray().value(1).endArray();
+  assert(b.bytes() == buf && b.toString() == "[1]");
+  // Spills over into a heap buffer
+  b.reset();
+  b.value("hello world, this spills");
+  assert(b.bytes() != buf && b.toString() == "\"hello world, this spills\"");
+
+  Builder t(buf, sizeof(buf), Builder::ThrowOnOverflow);
+  bool threw = false;
+  try { t.value("hello world, this throws"); }
+  catch (std::length_error&) { threw = true; }
+  assert(threw);
+  t.reset();
+  t.value(12);
+  size_t size;
+  const char* p = t.seizeBytes(size);
+  assert(p != buf && size == 2 && memcmp(p, "12", 2) == 0);
+  free((void*)p);
+}
+
+// Assignment replaces the buffer, which is freed only if the builder owns it
+static void test_assignment() {
+  char buf[16];
+  Builder e(buf, sizeof(buf));
+  e.value(1);
+  Builder m, s(Builder::StringStorage), v(Builder::VectorStorage);
+  m.value("malloc");
+  s.value("string");
+  v.value("vector");
+  Builder* all[] = {&e, &m, &s, &v};
+  for (size_t i = 0; i < 4; ++i) {
+    for (size_t j = 0; j < 4; ++j) {
+      Builder to(buf, 0);
+      if (j != 0) { to = *all[j]; }
+      to = *all[i];
+      assert(to.toString() == all[i]->toString());
+      assert(to.bytes() != all[i]->bytes());
+      to.value(2); // and it can grow
+      const Builder& self = to;
+      to = self;
+      assert(to.toString() == all[i]->toString() + ",2");
+      #if JSONT_CXX_RVALUE_REFS
+      Builder moved;
+      moved.value("old");
+      moved = std::move(to);
+      assert(moved.toString() == all[i]->toString() + ",2");
+      #endif
+    }
+  }
+}
+
+static void test_take_and_share() {
+  Builder b(Builder::StringStorage);
+  b.startArray();
+  for (int i = 0; i < 100; ++i) { b.value(i); }
+  b.endArray();
+  const char* bytes = b.bytes();
+  Builder copy(b);
+  std::string s = b.takeString();
+  assert(s.data() == bytes && s.size() == 291 && s.compare(0, 6, "[0,1,2") == 0);
+  assert(copy.takeString() == s);
+
+  Builder v(Builder::VectorStorage);
+  v.value("hi");
+  bytes = v.bytes();
+  std::vector<char> vec = v.takeVector();
+  assert(vec.data() == bytes && vec.size() == 4);
+  v.value(3);
+  assert(v.toString() == "3");
+
+  Builder h;
+  h.value("shared");
+  bytes = h.bytes();
+  SharedBytes sb = h.share();
+  SharedBytes sb2 = sb, sb3;
+  sb3 = sb2;
+  assert(sb3.bytes() == bytes && sb3.size() == 8);
+  assert(memcmp(sb3.bytes(), "\"shared\"", 8) == 0);
+  const SharedBytes& self = sb3;
+  sb3 = self;
+  sb = SharedBytes();
+  sb2 = sb;
+  assert(sb.empty() && sb2.empty() && sb3.bytes() == bytes);
+}
+
+static void test_bulk_values() {
+  std::vector<int64_t> iv;
+  for (int64_t i = -600; i < 600; ++i) { iv.push_back(i * i * i * 1000003LL); }
+  iv.push_back(INT64_MIN);
+  iv.push_back(INT64_MAX);
+  std::vector<double> dv;
+  for (int i = 0; i < 1000; ++i) { dv.push_back((i - 500) * 1.2345e-3); }
+  dv.push_back(-1.0 / 3);
+  int nv[] = {1, -2, 3};
+
+  Builder a, b;
+  a.startArray();
+  for (size_t i = 0; i < iv.size(); ++i) { a.value(iv[i]); }
+  for (size_t i = 0; i < dv.size(); ++i) { a.value(dv[i]); }
+  for (size_t i = 0; i < 3; ++i) { a.value(nv[i]); }
+  a.endArray();
+  b.startArray().values(iv.data(), iv.size()).values(dv.data(), dv.size())
+   .values(nv, 3).values((int*)0, 0).endArray();
+  assert(a.toString() == b.toString());
+
+  char buf[64];
+  Builder e(buf, sizeof(buf), Builder::ThrowOnOverflow);
+  int small[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17,
+                 18, 19, 20};
+  e.startArray().values(small, 20).endArray();
+  assert(e.toString() ==
+         "[1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20]");
+
+  unsigned long long ullv[] = {0, 18446744073709551615ULL};
+  long long llv[] = {-9223372036854775807LL - 1};
+  unsigned int uv[] = {4294967295U};
+  long lv[] = {-7};
+  unsigned long ulv[] = {42};
+  Builder w;
+  w.startArray().values(ullv, 2).values(llv, 1).values(uv, 1).values(lv, 1)
+   .values(ulv, 1).endArray();
+  assert(w.toString() == "[0,18446744073709551615,-9223372036854775808,"
+                         "4294967295,-7,42]");
+}
+
+static void test_array_chunks() {
+  std::vector<int> items;
+  for (int i = 0; i < 1003; ++i) { items.push_back(i); }
+  ArrayChunks chunks(8);
+  buildChunks(chunks, items.data(), items.size(),
+              [](Builder& b, const int& v) {
+    b.startObject().fieldName("v").value(v).endObject();
+  });
+  Builder ref;
+  ref.startArray();
+  for (int v : items) { ref.startObject().fieldName("v").value(v).endObject(); }
+  ref.endArray();
+  assert(chunks.size() == ref.size());
+
+  Builder out;
+  out.startObject().fieldName("a").value(chunks).endObject();
+  assert(out.toString() == "{\"a\":" + ref.toString() + "}");
+
+  struct iovec iov[32];
+  size_t n = chunks.toIOVecs(iov, 32);
+  assert(n == chunks.iovecCount());
+  std::string joined;
+  for (size_t i = 0; i < n; ++i) {
+    joined.append((const char*)iov[i].iov_base, iov[i].iov_len);
+  }
+  assert(joined == ref.toString());
+
+  ArrayChunks empty(2);
+  Builder e;
+  e.value(empty);
+  assert(e.toString() == "[]" && empty.size() == 2);
+
+  ArrayChunks failing(4);
+  bool caught = false;
+  try {
+    buildChunks(failing, items.data(), items.size(),
+                [](Builder& b, const int& v) {
+      if (v == 500 || v == 900) {
+        throw std::runtime_error(v == 500 ? "500" : "900");
+      }
+      b.value(v);
+    });
+  } catch (const std::runtime_error& err) {
+    caught = strcmp(err.what(), "500") == 0;
+  }
+  assert(caught);
+}
+
+static void canonical(const char* in, const char* expected) {
+  Tokenizer t(in, strlen(in), UTF8TextEncoding);
+  Builder b;
+  Canonicalizer c;
+  bool ok = c.transcode(t, b);
+  if (expected == 0) {
+    assert(!ok);
+  } else {
+    assert(ok && b.toString() == expected);
+  }
+}
+
+static void test_canonicalizer() {
+  canonical("{\"b\":[1,2.5,-3e2,\"x\\ny\\u001f\\u007f\\/\"],"
+            "\"a\":{\"z\":null,\"y\":true},\"c\":12}",
+            "{\"a\":{\"y\":true,\"z\":null},"
+            "\"b\":[1,2.5,-300,\"x\\ny\\u001f\x7f/\"],\"c\":12}");
+  // RFC 8785 section 3.2.3
+  canonical("{\"\\u20ac\":\"Euro Sign\",\"\\r\":\"Carriage Return\","
+            "\"\\ufb33\":\"Hebrew Letter Dalet With Dagesh\",\"1\":\"One\","
+            "\"\\ud83d\\ude00\":\"Emoji: Grinning Face\","
+            "\"\\u0080\":\"Control\","
+            "\"\\u00f6\":\"Latin Small Letter O With Diaeresis\"}",
+            "{\"\\r\":\"Carriage Return\",\"1\":\"One\","
+            "\"\xc2\x80\":\"Control\","
+            "\"\xc3\xb6\":\"Latin Small Letter O With Diaeresis\","
+            "\"\xe2\x82\xac\":\"Euro Sign\","
+            "\"\xf0\x9f\x98\x80\":\"Emoji: Grinning Face\","
+            "\"\xef\xac\xb3\":\"Hebrew Letter Dalet With Dagesh\"}");
+  canonical("[333333333.33333329, 1E30, 4.50, 2e-3, "
+            "0.000000000000000000000000001, -0, 1e21, 1e20]",
+            "[333333333.3333333,1e+30,4.5,0.002,1e-27,0,1e+21,"
+            "100000000000000000000]");
+  canonical("[]", "[]");
+  canonical("\"x\"", "\"x\"");
+  canonical("[1e999]", 0);
+  canonical("{\"a\" 1}", 0);
+}
+
+static void test_ascii_only() {
+  Builder a;
+  a.setASCIIOnly(true);
+  a.value("h\xc3\xa9llo \xe2\x82\xac \xf0\x9f\x98\x80 \x1a\x7f end");
+  assert(a.toString() ==
+         "\"h\\u00E9llo \\u20AC \\uD83D\\uDE00 \\u001A\\u007F end\"");
+  // Long enough for the vector kernels to be used
+  std::string s(100, 'x');
+  s += "\"\xc3\xa9";
+  Builder b;
+  b.setASCIIOnly(true);
+  b.value(s);
+  assert(b.toString() == "\"" + std::string(100, 'x') + "\\\"\\u00E9\"");
+
+  // Keys and template fragments are escaped up front for either mode
+  static const Key kKey("k\xc3\xa9\xf0\x9f\x98\x80");
+  Template t("{\"t\xc3\xa9\":?,\"\xe2\x82\xac\":[?]}");
+  Builder c;
+  c.setASCIIOnly(true);
+  c.startArray().startObject().field(kKey).value(1).endObject();
+  t.render(c).value("\xc3\xa9").value(2);
+  c.endArray();
+  assert(c.toString() == "[{\"k\\u00E9\\uD83D\\uDE00\":1},"
+                         "{\"t\\u00E9\":\"\\u00E9\",\"\\u20AC\":[2]}]");
+  Builder d;
+  d.startObject().field(kKey).value(1).endObject();
+  t.render(d).value("x").value(2);
+  assert(d.toString() == "{\"k\xc3\xa9\xf0\x9f\x98\x80\":1},"
+                         "{\"t\xc3\xa9\":\"x\",\"\xe2\x82\xac\":[2]}");
+}
+
+static void test_utf8_validation() {
+  const char* s = "ok \xc3\xa9 bad:\xff|\xc0\x80|\xed\xa0\x80|\xe2\x82";
+  Builder r;
+  r.setUTF8Validation(Builder::ReplaceInvalidUTF8);
+  r.value(s);
+  assert(r.toString() == "\"ok \xc3\xa9 bad:\xef\xbf\xbd|"
+         "\xef\xbf\xbd\xef\xbf\xbd|"
+         "\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd|"
+         "\xef\xbf\xbd\xef\xbf\xbd\"");
+  Builder ra;
+  ra.setUTF8Validation(Builder::ReplaceInvalidUTF8).setASCIIOnly(true);
+  ra.value("\xc3\xa9\xff");
+  assert(ra.toString() == "\"\\u00E9\\uFFFD\"");
+
+  Builder x;
+  x.setUTF8Validation(Builder::RejectInvalidUTF8);
+  x.value("fine \xc3\xa9");
+  assert(x.toString() == "\"fine \xc3\xa9\"");
+  bool threw = false;
+  try { x.value(s); } catch (std::invalid_argument&) { threw = true; }
+  assert(threw);
+}
+
+static void test_template() {
+  Template t("{ \"id\": ?, \"name\" : ?, \"a b\\\"?\":[?, true, ?], "
+             "\"x\":{\"y\":?} }");
+  assert(t.holeCount() == 5);
+  Builder b;
+  b.startArray();
+  t.render(b).value(12).value("A\"b").value(1.5).nullValue().value(false);
+  b.value(3);
+  Template::Renderer r = t.render(b);
+  r.value((int64_t)-1).value(std::string("s")).rawValue("[1]", 3).value(true);
+  assert(!r.done());
+  r.value("z");
+  assert(r.done());
+  b.endArray();
+  assert(b.toString() ==
+    "[{\"id\":12,\"name\":\"A\\\"b\",\"a b\\\"?\":[1.5,true,null],"
+    "\"x\":{\"y\":false}},3,"
+    "{\"id\":-1,\"name\":\"s\",\"a b\\\"?\":[[1],true,true],"
+    "\"x\":{\"y\":\"z\"}}]");
+
+  Template s("?");
+  Builder c;
+  s.render(c).value(7);
+  assert(c.toString() == "7");
+
+  // Integers of every width, as for Builder::value
+  Template w("[?,?,?,?,?,?,?]");
+  Builder d;
+  w.render(d).value(-1).value(4000000000u).value(-2L).value(3UL)
+   .value(-4LL).value(18446744073709551615ULL).value((int64_t)5);
+  assert(d.toString() == "[-1,4000000000,-2,3,-4,18446744073709551615,5]");
+
+  // Holes must be separated like values, e.g. not "[??]"
+  const char* bad[] = {"{?:1}", "[?,]", "? ?", "{\"a\":1", "", "[1]x",
+                       "[??]", "{\"a\":?\"b\":?}", "[?1]", "[1?]"};
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+    bool threw = false;
+    try { Template x(bad[i]); } catch (std::invalid_argument&) { threw = true; }
+    assert(threw);
+  }
+}
+
+static void test_serialize() {
+  app::Point o = {1, 2};
+  app::Shape s;
+  s.name = "tri\"x"; s.area = 1.5; s.filled = true; s.id = -5;
+  s.points.push_back(app::Point{3, 4});
+  s.points.push_back(app::Point{5, 6});
+  s.tags["a"].push_back(1);
+  s.tags["b"];
+  s.origin = &o; s.center = app::Point{7, 8}; s.label = 0; s.n = 3;
+  Builder b;
+  serialize(b, s);
+  std::string out = b.toString();
+  assert(out ==
+    "{\"name\":\"tri\\\"x\",\"area\":1.5,\"filled\":true,\"id\":-5,"
+    "\"points\":[{\"x\":3,\"y\":4},{\"x\":5,\"y\":6}],"
+    "\"tags\":{\"a\":[1],\"b\":[]},\"origin\":{\"x\":1,\"y\":2},"
+    "\"note\":null,\"center\":{\"x\":7,\"y\":8},\"label\":null,\"n\":3}");
+  assert(estimateSize(s) >= out.size());
+
+  std::vector<app::Shape> v(3, s);
+  Builder c;
+  serialize(c, v);
+  assert(c.size() == out.size() * 3 + 4);
+
+  // The estimate is reserved up front
+  char buf[16];
+  Builder e(buf, sizeof(buf), Builder::ThrowOnOverflow);
+  serialize(e, o);
+  assert(e.toString() == "{\"x\":1,\"y\":2}");
+
+  // Unsigned 64-bit numbers aren't converted to int64_t
+  app::Sizes z = {-3, 65535, 7, 18446744073709551615ULL,
+                  INT64_MIN, UINT64_MAX, 42};
+  Builder d;
+  serialize(d, z);
+  assert(d.toString() ==
+    "{\"s\":-3,\"us\":65535,\"ul\":7,\"ull\":18446744073709551615,"
+    "\"i64\":-9223372036854775808,\"u64\":18446744073709551615,\"z\":42}");
+  assert(estimateSize(z) >= d.size());
+}
+
+static void test_unchecked_appender() {
+  static const Key kA("a"), kB("b");
+  Builder b;
+  b.startArray().value(1);
+  {
+    UncheckedAppender u(b, 200);
+    u.startObject().field(kA).value("x\"\n", 3).field(kB).startArray()
+     .value(1.5).value((int64_t)-3).value(true).nullValue().rawValue("{}", 2)
+     .value(false).endArray().endObject();
+    u.value(7);
+  }
+  b.value(8).endArray();
+  assert(b.toString() ==
+         "[1,{\"a\":\"x\\\"\\n\",\"b\":[1.5,-3,true,null,{},false]},7,8]");
+
+  // Reserving exactly the size of the output
+  char buf[5];
+  Builder e(buf, sizeof(buf), Builder::ThrowOnOverflow);
+  {
+    UncheckedAppender u(e, 5);
+    u.value((int64_t)12345);
+    assert(u.available() == 0);
+  }
+  assert(e.toString() == "12345");
+
+  // C strings aren't taken for bools, and every integer type is accepted
+  Builder c;
+  {
+    UncheckedAppender u(c, 100);
+    u.startArray().value("abc").value(std::string("d\"e")).value(-1L)
+     .value(2U).value((uint64_t)UINT64_MAX).value((size_t)4).value(5LL)
+     .endArray();
+  }
+  assert(c.toString() ==
+         "[\"abc\",\"d\\\"e\",-1,2,18446744073709551615,4,5]");
+}
+
+static void test_escaped_passthrough() {
+  const char* in = "{\"a\\nb\":\"x\\u00e9\\\"y\",\"plain\":[\"p\", 12, "
+                   "\"\\ud83d\\ude00\"]}";
+  Tokenizer t(in, strlen(in), UTF8TextEncoding);
+  Builder b;
+  const char* p;
+  size_t n;
+  for (Token k = t.current(); k != End; k = t.next()) {
+    assert(k != Error);
+    switch (k) {
+      case ObjectStart: b.startObject(); break;
+      case ObjectEnd: b.endObject(); break;
+      case ArrayStart: b.startArray(); break;
+      case ArrayEnd: b.endArray(); break;
+      case FieldName:
+        n = t.escapedValue(&p);
+        b.fieldNameEscaped(p, n, true);
+        break;
+      case String:
+        n = t.escapedValue(&p);
+        b.valueEscaped(p, n, true);
+        break;
+      default:
+        n = t.escapedValue(&p);
+        b.rawValue(p, n);
+        break;
+    }
+  }
+  assert(b.toString() == "{\"a\\nb\":\"x\\u00e9\\\"y\","
+         "\"plain\":[\"p\",12,\"\\ud83d\\ude00\"]}");
+
+  // Invalid escaped input is rejected, leaving the builder as it was
+  const char* bad[] = {"a\"b", "a\\", "\\q", "\\u12", "\\u12G4", "a\nb"};
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+    Builder c;
+    c.startArray().value(1);
+    bool threw = false;
+    try { c.valueEscaped(bad[i], strlen(bad[i]), true); }
+    catch (std::invalid_argument&) { threw = true; }
+    assert(threw);
+    c.value(2).endArray();
+    assert(c.toString() == "[1,2]");
+  }
+  // and hex digits are taken in either case
+  Builder h;
+  h.valueEscaped("\\u00E9\\u00e9", 12, true);
+  assert(h.toString() == "\"\\u00E9\\u00e9\"");
+}
+
+int main(int argc, const char** argv) {
+  test_indentation();
+  test_key();
+  test_external_buffer();
+  test_assignment();
+  test_take_and_share();
+  test_bulk_values();
+  test_array_chunks();
+  test_canonicalizer();
+  test_ascii_only();
+  test_utf8_validation();
+  test_template();
+  test_serialize();
+  test_unchecked_appender();
+  test_escaped_passthrough();
+  printf("PASS\n");
+  return 0;
+}
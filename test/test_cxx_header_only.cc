@@ -0,0 +1,32 @@
+// Builds without jsont.cc, which JSONT_HEADER_ONLY compiles in here instead
+#define JSONT_HEADER_ONLY
+#include <jsont.hh>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+using namespace jsont;
+
+int main(int argc, const char** argv) {
+  const char* in = "{\"a\":[1,-2.5,\"x\\ny\",true,null],\"b\":{}}";
+  Tokenizer t(in, strlen(in), UTF8TextEncoding);
+  Builder b;
+  for (Token k = t.current(); k != End; k = t.next()) {
+    switch (k) {
+      case ObjectStart: b.startObject(); break;
+      case ObjectEnd: b.endObject(); break;
+      case ArrayStart: b.startArray(); break;
+      case ArrayEnd: b.endArray(); break;
+      case FieldName: b.fieldName(t.stringValue()); break;
+      case String: b.value(t.stringValue()); break;
+      case Integer: b.value(t.intValue()); break;
+      case Float: b.value(t.floatValue()); break;
+      case True: b.value(true); break;
+      case Null: b.nullValue(); break;
+      default: assert(false);
+    }
+  }
+  assert(b.toString() == in);
+  printf("PASS\n");
+  return 0;
+}
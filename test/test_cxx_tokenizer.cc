@@ -0,0 +1,347 @@
+#include <jsont.hh>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+using namespace jsont;
+
+static void test_string_value() {
+  const char* in = "[\"a\\\\nb\",\"\\ud83d\\ude00\\u00e9\\/\",\"\\u12\"]";
+  Tokenizer t(in, strlen(in), UTF8TextEncoding);
+  assert(t.current() == ArrayStart);
+  assert(t.next() == String && t.stringValue() == "a\\nb");
+  assert(t.next() == String && t.stringValue() == "\xf0\x9f\x98\x80\xc3\xa9/");
+  assert(t.next() == Error);
+  assert(t.error() == Tokenizer::MalformedUnicodeEscapeSequence);
+
+  // Surrogates must come in pairs
+  const char* malformed[] = {"[\"\\ud800\"]", "[\"\\ud800\\ux",
+                             "[\"\\ud800\\u0041\"]", "[\"\\udc00\"]"};
+  for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i) {
+    Tokenizer u(malformed[i], strlen(malformed[i]), UTF8TextEncoding);
+    assert(u.next() == Error);
+    assert(u.error() == Tokenizer::MalformedUnicodeEscapeSequence);
+  }
+  const char* truncated[] = {"[\"\\ud800\\", "[\"\\ud800\\u",
+                             "[\"\\ud800\\udc"};
+  for (size_t i = 0; i < sizeof(truncated) / sizeof(truncated[0]); ++i) {
+    Tokenizer u(truncated[i], strlen(truncated[i]), UTF8TextEncoding);
+    assert(u.next() == Error);
+    assert(u.error() == Tokenizer::PrematureEndOfInput);
+  }
+}
+
+static void test_raw_value() {
+  const char* in = "{\"skip\": {\"a\": [1, \"]}\\\"\", {}], \"b\":null}, "
+                   "\"n\" :  -12.5e3 , \"s\": \"x\\\"y\", \"t\":true, "
+                   "\"k\": [ ], \"last\":1}";
+  Tokenizer t(in, strlen(in), UTF8TextEncoding);
+  Builder b;
+  b.startObject();
+  for (Token k = t.next(); k != ObjectEnd; k = t.next()) {
+    assert(k == FieldName);
+    b.fieldName(t.stringValue());
+    t.next();
+    const char* p;
+    size_t n = t.rawValue(&p);
+    assert(n != 0);
+    b.rawValue(p, n);
+  }
+  b.endObject();
+  assert(b.toString() ==
+         "{\"skip\":{\"a\": [1, \"]}\\\"\", {}], \"b\":null},\"n\":-12.5e3,"
+         "\"s\":\"x\\\"y\",\"t\":true,\"k\":[ ],\"last\":1}");
+  assert(t.next() == End);
+
+  const char* p;
+  const char* bad = "[{\"a\":\"]";
+  Tokenizer u(bad, strlen(bad), UTF8TextEncoding);
+  assert(u.rawValue(&p) == 0 && u.current() == Error);
+  const char* truncated = "[[1]";
+  Tokenizer w(truncated, strlen(truncated), UTF8TextEncoding);
+  assert(w.rawValue(&p) == 0);
+  assert(w.error() == Tokenizer::PrematureEndOfInput);
+
+  // Brackets must match, nested no deeper than MaxDepth
+  const char* mismatched = "[{\"a\":[1}],2]";
+  Tokenizer m(mismatched, strlen(mismatched), UTF8TextEncoding);
+  assert(m.rawValue(&p) == 0 && m.current() == Error);
+  assert(m.error() == Tokenizer::UnexpectedObjectEnd && m.inputOffset() == 9);
+  Tokenizer o("{\"a\":]}", 7, UTF8TextEncoding);
+  assert(o.rawValue(&p) == 0 && o.error() == Tokenizer::UnexpectedArrayEnd);
+  std::string deep(Tokenizer::MaxDepth, '[');
+  deep += std::string(Tokenizer::MaxDepth, ']');
+  Tokenizer d(deep.data(), deep.size(), UTF8TextEncoding);
+  assert(d.rawValue(&p) == deep.size() && d.next() == End);
+  deep = "[" + deep + "]";
+  Tokenizer e(deep.data(), deep.size(), UTF8TextEncoding);
+  assert(e.rawValue(&p) == 0 && e.error() == Tokenizer::NestingTooDeep);
+  // and a NUL byte ends the input
+  Tokenizer n("[\"\0\"]", 5, UTF8TextEncoding);
+  assert(n.rawValue(&p) == 0 && n.error() == Tokenizer::UnterminatedString);
+  Tokenizer z("[1\0]", 4, UTF8TextEncoding);
+  assert(z.rawValue(&p) == 0 && z.error() == Tokenizer::PrematureEndOfInput);
+
+  // Reading continues with the state after the value
+  const char* nested = "[{\"a\":[1]}, [[]] 2, {}]";
+  Tokenizer v(nested, strlen(nested), UTF8TextEncoding);
+  assert(v.next() == ObjectStart);
+  assert(v.rawValue(&p) == 9 && memcmp(p, "{\"a\":[1]}", 9) == 0);
+  assert(v.current() == ObjectEnd);
+  assert(v.next() == ArrayStart);
+  assert(v.rawValue(&p) == 4 && v.current() == ArrayEnd);
+  assert(v.next() == Error && v.error() == Tokenizer::SyntaxError);
+  const char* after = "{\"x\":[1,2]}]";
+  Tokenizer x(after, strlen(after), UTF8TextEncoding);
+  x.next(); x.next();
+  assert(x.rawValue(&p) == 5);
+  assert(x.next() == ObjectEnd);
+  assert(x.next() == Error && x.error() == Tokenizer::UnexpectedArrayEnd);
+  assert(x.rawValue(&p) == 0);
+  Tokenizer y("\"s\"", 3, UTF8TextEncoding);
+  assert(y.rawValue(&p) == 3 && y.next() == End);
+}
+
+static void test_view_and_assign() {
+  const char* in = "{\"name\":\"a\\nb\",\"k\":\"plain\",\"n\":12}";
+  Tokenizer t(in, strlen(in), UTF8TextEncoding);
+  std::string s;
+  s.reserve(64);
+  const char* data = s.data();
+  t.next(); t.assignTo(s); assert(s == "name");
+  t.next(); t.assignTo(s); assert(s == "a\nb" && t.view() == "a\nb");
+  t.next(); t.appendTo(s); assert(s == "a\nbk");
+  t.next(); assert(t.view() == "plain");
+  t.next(); t.next(); assert(t.view() == "12");
+  t.next(); assert(t.view().empty());
+  t.assignTo(s);
+  assert(s.empty());
+  // Reused rather than reallocated
+  assert(s.data() == data);
+}
+
+static void test_batch() {
+  const char* in = "{\"a\\n\":[1, -2.5, true, false, null, \"x\\u00e9\"], "
+                   "\"b\":{}} 42";
+  Tokenizer t(in, strlen(in), UTF8TextEncoding);
+  std::vector<TokenRecord> all;
+  all.push_back(t.record());
+  TokenRecord records[4];
+  size_t n;
+  while ((n = t.nextBatch(records, 4)) != 0) {
+    all.insert(all.end(), records, records + n);
+    if (records[n-1].token == End || records[n-1].token == Error) { break; }
+  }
+  assert(all.size() == 16);
+  std::string s;
+  assert(all[1].token == FieldName && all[1].flags == TokenRecord::Escaped);
+  t.assignTo(all[1], s);
+  assert(s == "a\n");
+  assert(t.intValue(all[3]) == 1 && t.floatValue(all[4]) == -2.5);
+  t.assignTo(all[8], s);
+  assert(s == "x\xc3\xa9");
+  assert(all[14].token == Integer && t.intValue(all[14]) == 42);
+  assert(all[15].token == End);
+}
+
+static Tokenizer::ErrorCode error_of(const std::string& in) {
+  Tokenizer t(in.data(), in.size(), UTF8TextEncoding);
+  for (Token k = t.current(); k != End; k = t.next()) {
+    if (k == Error) { return t.error(); }
+  }
+  return Tokenizer::UnspecifiedError;
+}
+
+static void test_errors() {
+  assert(error_of("[1:2]") == Tokenizer::UnexpectedColon);
+  assert(error_of("{\"a\"::1}") == Tokenizer::UnexpectedColon);
+  assert(error_of(":") == Tokenizer::UnexpectedColon);
+  assert(error_of("[1}") == Tokenizer::UnexpectedObjectEnd);
+  assert(error_of("}") == Tokenizer::UnexpectedObjectEnd);
+  assert(error_of("{\"a\":1]") == Tokenizer::UnexpectedArrayEnd);
+  assert(error_of("]") == Tokenizer::UnexpectedArrayEnd);
+  assert(error_of("[1,]") == Tokenizer::UnexpectedTrailingComma);
+  assert(error_of("[,1]") == Tokenizer::UnexpectedComma);
+  assert(error_of("[1 2]") == Tokenizer::SyntaxError);
+  assert(error_of("[\"ab") == Tokenizer::UnterminatedString);
+  assert(error_of("[nul") == Tokenizer::PrematureEndOfInput);
+  assert(error_of("[nulx]") == Tokenizer::InvalidByte);
+
+  // A NUL byte ends the input as its length does, also inside a token
+  assert(error_of(std::string("[1]\0\0", 5)) == Tokenizer::UnspecifiedError);
+  assert(error_of(std::string("[\"ab\0\"]", 7)) ==
+         Tokenizer::UnterminatedString);
+  assert(error_of(std::string("[nu\0l]", 6)) == Tokenizer::PrematureEndOfInput);
+  assert(error_of(std::string("[\"\\u00\0\"]", 9)) ==
+         Tokenizer::PrematureEndOfInput);
+
+  // Nesting up to MaxDepth, and not beyond
+  std::string deep(Tokenizer::MaxDepth, '[');
+  deep.append(Tokenizer::MaxDepth, ']');
+  assert(error_of(deep) == Tokenizer::UnspecifiedError);
+  assert(error_of("[" + deep + "]") == Tokenizer::NestingTooDeep);
+  std::string objects;
+  for (int i = 0; i <= Tokenizer::MaxDepth; ++i) { objects += "{\"a\":"; }
+  assert(error_of(objects) == Tokenizer::NestingTooDeep);
+  // reported just past the bracket which is one too many
+  deep.insert(0, "[");
+  Tokenizer t(deep.data(), deep.size(), UTF8TextEncoding);
+  while (t.current() == ArrayStart) { t.next(); }
+  assert(t.current() == Error && t.error() == Tokenizer::NestingTooDeep);
+  assert(t.inputOffset() == (size_t)Tokenizer::MaxDepth + 1);
+}
+
+struct Printer : Handler {
+  std::string out;
+  Tokenizer::ErrorCode error;
+  Printer() : error(Tokenizer::UnspecifiedError) {}
+  void onObjectStart() { out += "{"; }
+  void onObjectEnd() { out += "}"; }
+  void onArrayStart() { out += "["; }
+  void onArrayEnd() { out += "]"; }
+  void onKey(std::string_view k) { out += "K("; out += k; out += ")"; }
+  void onString(std::string_view v) { out += "S("; out += v; out += ")"; }
+  void onInt(int64_t v) { out += "I" + std::to_string(v); }
+  void onFloat(double v) { out += "F" + std::to_string(v); }
+  void onBool(bool v) { out += v ? "T" : "F"; }
+  void onNull() { out += "N"; }
+  void onError(Tokenizer::ErrorCode e, size_t) { error = e; }
+};
+
+static void test_parse() {
+  const char* in = "{\"a\\n\":[1,-2.5,true,false,null,\"x\"],\"b\":{}}";
+  Printer p;
+  assert(parse(in, strlen(in), p));
+  assert(p.out == "{K(a\n)[I1F-2.500000TFNS(x)]K(b){}}");
+  Printer e;
+  assert(!parse("[1,,2]", 6, e) && e.error == Tokenizer::UnexpectedComma);
+  // Input without any value is an error
+  Printer z;
+  assert(!parse("", 0, z) && z.out.empty());
+  assert(z.error == Tokenizer::PrematureEndOfInput);
+  Printer w;
+  assert(!parse(" \n", 2, w) && w.error == Tokenizer::PrematureEndOfInput);
+
+  // Values at the end of the input, and escaped strings
+  Printer v;
+  in = "[\"\\u00e5\\\"\", \"\"] 12 -2.5";
+  assert(parse(in, strlen(in), v));
+  assert(v.out == "[S(\xc3\xa5\")S()]I12F-2.500000");
+
+  // Truncated input
+  const char* truncated[] = {"[1,2", "{\"a\":[", "{\"a\"", "[\"ab"};
+  for (size_t i = 0; i < sizeof(truncated) / sizeof(truncated[0]); ++i) {
+    Printer t;
+    assert(!parse(truncated[i], strlen(truncated[i]), t));
+    assert(t.error == Tokenizer::PrematureEndOfInput ||
+           t.error == Tokenizer::UnterminatedString);
+  }
+  Printer u;
+  assert(!parse("[1,2", 4, u) && u.error == Tokenizer::PrematureEndOfInput);
+
+  // Several top-level values
+  Printer m;
+  assert(parse("1 [] \"x\"\n{}", 11, m) && m.out == "I1[]S(x){}");
+}
+
+static void same_trusted(const char* in) {
+  size_t n = strlen(in);
+  Tokenizer a(in, n, UTF8TextEncoding), b(in, n, UTF8TextEncoding);
+  for (Token k = a.current(); ; k = a.next()) {
+    assert(b.current() == k);
+    if (a.hasValue()) { assert(a.stringValue() == b.stringValue()); }
+    if (k == End) { break; }
+    b.nextTrusted();
+  }
+}
+
+static void test_next_trusted() {
+  same_trusted("{\"a\\n\\\"\" : [1, -2.5e+3, true,false , null,\"x\"],"
+               "\"b\":{},\"c\":[[]], \"d\" :\"\\u00e5\"}");
+  same_trusted("  [ 0 , 123456789012 , \"\" ]  ");
+  same_trusted("\"lone\"");
+  same_trusted("");
+
+  // Mixed with next, which still checks what nextTrusted skipped
+  const char* in = "{\"a\":[1,{\"b\":null}],\"c\":true} [1 2]";
+  Tokenizer t(in, strlen(in), UTF8TextEncoding);
+  assert(t.current() == ObjectStart);
+  assert(t.nextTrusted() == FieldName && t.stringValue() == "a");
+  assert(t.next() == ArrayStart);
+  assert(t.nextTrusted() == Integer && t.intValue() == 1);
+  assert(t.next() == ObjectStart);
+  assert(t.nextTrusted() == FieldName);
+  assert(t.nextTrusted() == Null);
+  assert(t.next() == ObjectEnd);
+  assert(t.nextTrusted() == ArrayEnd);
+  assert(t.next() == FieldName && t.stringValue() == "c");
+  assert(t.nextTrusted() == True);
+  assert(t.next() == ObjectEnd);
+  assert(t.nextTrusted() == ArrayStart);
+  assert(t.next() == Integer);
+  assert(t.next() == Error && t.error() == Tokenizer::SyntaxError);
+  // Truncated input ends rather than being read past
+  const char* truncated[] = {"[tr", "\"abc", "\"ab\\", "[1,", "{\"a\"", "-"};
+  for (size_t i = 0; i < sizeof(truncated) / sizeof(truncated[0]); ++i) {
+    size_t n = strlen(truncated[i]);
+    char* buf = (char*)malloc(n);
+    memcpy(buf, truncated[i], n);
+    Tokenizer t(buf, n, UTF8TextEncoding);
+    int count = 0;
+    for (Token k = t.current(); k != End; k = t.nextTrusted()) {
+      assert(++count < 10);
+    }
+    free(buf);
+  }
+}
+
+static void same_padded(const std::string& in) {
+  char* padded = Tokenizer::allocPadded(in.size());
+  memcpy(padded, in.data(), in.size());
+  Tokenizer a(in.data(), in.size(), UTF8TextEncoding);
+  Tokenizer b(padded, 0, UTF8TextEncoding);
+  b.resetPadded(padded, in.size(), UTF8TextEncoding);
+  for (Token k = a.current(); ; k = a.next()) {
+    assert(b.current() == k && a.inputOffset() == b.inputOffset());
+    if (k == Error) {
+      assert(a.error() == b.error());
+      break;
+    }
+    if (a.hasValue()) { assert(a.stringValue() == b.stringValue()); }
+    if (k == Integer) { assert(a.intValue() == b.intValue()); }
+    if (k == Float) { assert(a.floatValue() == b.floatValue()); }
+    if (k == End) { break; }
+    b.next();
+  }
+  free(padded);
+}
+
+static void test_padded() {
+  same_padded("{\"a\\n\\\"\" : [1, -2.5e+3, true,false , null,\"x\"],"
+              "\"b\":{},\"c\":[[]], \"d\" :\"\\u00e5\"}");
+  same_padded("[\"a string longer than sixteen bytes, with \\\\ and \\\" "
+              "inside it\"]");
+  same_padded("123");
+  same_padded("-1.25");
+  same_padded("\"abc");
+  same_padded("\"abc\\");
+  same_padded("\"");
+  same_padded("\"\\u12");
+  same_padded("[\"\\ud800\\u");
+  same_padded("[\"\\ud800\"]");
+  same_padded("[\"\\ud83d\\ude00\"]");
+  same_padded(std::string("[\"a\0b\"]", 7));
+}
+
+int main(int argc, const char** argv) {
+  test_string_value();
+  test_raw_value();
+  test_view_and_assign();
+  test_batch();
+  test_errors();
+  test_parse();
+  test_next_trusted();
+  test_padded();
+  printf("PASS\n");
+  return 0;
+}
@@ -0,0 +1,117 @@
+#define _POSIX_C_SOURCE 200809L // setenv, fork
+#include <jsont.h>
+#include "jsont_kernels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#if _JSONT_X86_DISPATCH
+  #include <unistd.h>
+  #include <sys/wait.h>
+#endif
+
+// Compares the kernels in use with the word kernels, for a byte of each kind
+// at each position of strings of each length, at a few alignments
+static void test_kernels(void) {
+  static const uint8_t kBytes[] = {'"', '\\', 0, 0x1f, 0x7f, 0x80, 0xff, 'a'};
+  static const size_t kAligns[] = {0, 1, 7, 31};
+  uint8_t* buf = jsont_alloc_padded(256);
+  assert(buf != NULL);
+  for (size_t a = 0; a < sizeof(kAligns) / sizeof(kAligns[0]); ++a) {
+    for (size_t len = 0; len <= 256 - kAligns[a]; len += (len < 80) ? 1 : 7) {
+      for (size_t pos = 0; pos < len || pos == 0; ++pos) {
+        for (size_t k = 0; k < sizeof(kBytes); ++k) {
+          const uint8_t* p = buf + kAligns[a];
+          const uint8_t* end = p + len;
+          memset(buf, ' ', kAligns[a] + len);
+          memset(buf + kAligns[a] + len, 0, 256 - kAligns[a] - len);
+          if (pos < len) {
+            buf[kAligns[a] + pos] = kBytes[k];
+          }
+          assert(_jsont_find_escape(p, end, false) ==
+                 _jsont_find_escape_word(p, end, false));
+          assert(_jsont_find_escape(p, end, true) ==
+                 _jsont_find_escape_word(p, end, true));
+          assert(_jsont_find_string_end_padded(p) ==
+                 _jsont_find_string_end_padded_word(p));
+          assert(_jsont_find_string_end(p, end) ==
+                 _jsont_find_string_end_tail(p, end));
+        }
+      }
+    }
+  }
+  free(buf);
+}
+
+// Compares the number parsers, whose fast paths skip strtod and strtoll, with
+// those functions
+static void test_numbers(void) {
+  static const char* const kNumbers[] = {
+    "0", "-0", "1", "-1", "12345", "1.5", "-2.25", "0.1", "0.3", "1e10",
+    "1E-5", "2.5e+3", "123456789012345678", "-123456789012345678",
+    "1234567890123456789", "9223372036854775807", "-9223372036854775808",
+    "9223372036854775808", "99999999999999999999", "9007199254740993",
+    "1e22", "1e23", "1e-22", "1e-23", "3.141592653589793", "1.7976931348623157e308",
+    "5e-324", "1e400", "00012", "1.", ".5", "1e", "-", "1.5e3x",
+  };
+  for (size_t i = 0; i < sizeof(kNumbers) / sizeof(kNumbers[0]); ++i) {
+    const char* n = kNumbers[i];
+    size_t len = strlen(n);
+    double d = _jsont_parse_float(n, len, true);
+    double expected = strtod(n, (char**)0);
+    assert(d == expected || (d != d && expected != expected));
+    assert(signbit(d) == signbit(expected));
+    assert(_jsont_parse_float(n, len, false) == d || d != d);
+    if (strchr(n, '.') == 0 && strchr(n, 'e') == 0 && strchr(n, 'E') == 0) {
+      assert(_jsont_parse_int(n, len, true) == strtoll(n, (char**)0, 10));
+    }
+  }
+}
+
+#if _JSONT_X86_DISPATCH
+static bool cpu_supports(int level) {
+  switch (level) {
+    case kSIMDSSE2: return __builtin_cpu_supports("sse2");
+    case kSIMDSSE42: return __builtin_cpu_supports("sse4.2");
+    case kSIMDAVX2: return __builtin_cpu_supports("avx2");
+    case kSIMDAVX512: return __builtin_cpu_supports("avx512bw");
+    default: return true;
+  }
+}
+
+// Each level is bound once per process, so each is tested in a child with
+// JSONT_SIMD set to it
+static void test_level(int level) {
+  static const char* const kNames[] = {
+    "none", "sse2", "sse4.2", "avx2", "avx512",
+  };
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    setenv("JSONT_SIMD", kNames[level], 1);
+    __builtin_cpu_init();
+    int bound = _jsont_simd_level();
+    assert(bound <= level);
+    assert(bound == level || !cpu_supports(level));
+    assert((int)jsont_simd_level() == bound);
+    test_kernels();
+    exit(0);
+  }
+  int status;
+  assert(waitpid(pid, &status, 0) == pid);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+#endif
+
+int main(int argc, const char** argv) {
+  test_numbers();
+  #if _JSONT_X86_DISPATCH
+  for (int level = kSIMDNone; level <= kSIMDAVX512; ++level) {
+    test_level(level);
+  }
+  #else
+  test_kernels();
+  #endif
+  printf("PASS\n");
+  return 0;
+}
@@ -173,6 +173,157 @@ int main(int argc, const char** argv) {
   assert(jsont_next(S) == JSONT_ARRAY_END);
   assert(jsont_next(S) == JSONT_OBJECT_END);
 
+  // Escaped strings are compared without being unescaped, and unescaped on
+  // demand
+  inbuf = "[\"a\\\\nb\", \"\\ud83d\\ude00\\u00e9\", 12]";
+  jsont_reset(S, (const uint8_t*)inbuf, strlen(inbuf));
+  assert(jsont_next(S) == JSONT_ARRAY_START);
+  assert(jsont_next(S) == JSONT_STRING);
+  assert(jsont_str_equals(S, "a\\nb") == true);
+  assert(jsont_str_equals(S, "a\\n") == false);
+  assert(jsont_str_equals(S, "a\nb") == false);
+  assert(jsont_data_value(S, &bytes) == 4);
+  assert(memcmp(bytes, "a\\nb", 4) == 0);
+  assert(jsont_next(S) == JSONT_STRING);
+  assert(jsont_str_equals(S, "\xf0\x9f\x98\x80\xc3\xa9") == true);
+  assert(jsont_next(S) == JSONT_NUMBER_INT);
+  assert(jsont_int_value(S) == 12);
+  assert(jsont_next(S) == JSONT_ARRAY_END);
+
+  // Tokens read in bulk
+  inbuf = "{\"a\\n\":[1, true, false, null]} ";
+  jsont_reset(S, (const uint8_t*)inbuf, strlen(inbuf));
+  jsont_record_t records[16];
+  assert(jsont_next_batch(S, records, 3) == 3);
+  assert(jsont_next_batch(S, records + 3, 16) == 7);
+  assert(records[0].tok == JSONT_OBJECT_START && records[0].offset == 0);
+  assert(records[1].tok == JSONT_FIELD_NAME);
+  assert(records[1].flags == JSONT_RECORD_ESCAPED);
+  uint8_t unescaped[3];
+  assert(jsont_unescape((const uint8_t*)inbuf + records[1].offset,
+                        records[1].length, unescaped) == 2);
+  assert(memcmp(unescaped, "a\n", 2) == 0);
+  assert(records[3].tok == JSONT_NUMBER_INT);
+  assert(records[3].offset == 8 && records[3].length == 1);
+  assert(records[4].tok == JSONT_TRUE && records[4].offset == 11);
+  assert(records[5].tok == JSONT_FALSE && records[5].length == 5);
+  assert(records[6].tok == JSONT_NULL && records[6].offset == 24);
+  assert(records[8].tok == JSONT_OBJECT_END && records[8].offset == 29);
+  assert(records[9].tok == JSONT_END);
+
+  // A lead surrogate must be followed by a trail surrogate
+  inbuf = "[\"\\ud83d\\u0041\"]";
+  jsont_reset(S, (const uint8_t*)inbuf, strlen(inbuf));
+  assert(jsont_next(S) == JSONT_ARRAY_START);
+  assert(jsont_next(S) == JSONT_ERR);
+  inbuf = "[\"\\ud800\"]";
+  jsont_reset(S, (const uint8_t*)inbuf, strlen(inbuf));
+  assert(jsont_next(S) == JSONT_ARRAY_START);
+  assert(jsont_next(S) == JSONT_ERR);
+  inbuf = "[\"\\ud800\\ux";
+  jsont_reset(S, (const uint8_t*)inbuf, strlen(inbuf));
+  assert(jsont_next(S) == JSONT_ARRAY_START);
+  assert(jsont_next(S) == JSONT_ERR);
+  // and a trail surrogate may not stand alone
+  inbuf = "[\"\\udc00\"]";
+  jsont_reset(S, (const uint8_t*)inbuf, strlen(inbuf));
+  assert(jsont_next(S) == JSONT_ARRAY_START);
+  assert(jsont_next(S) == JSONT_ERR);
+  // Input ending inside the trail surrogate, at its end or at a NUL byte, is
+  // a premature end rather than a malformed sequence
+  const char* prefixes[] = {"[\"\\ud800\\", "[\"\\ud800\\u",
+                            "[\"\\ud800\\udc"};
+  for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); ++i) {
+    uint8_t zeroed[16] = {0};
+    memcpy(zeroed, prefixes[i], strlen(prefixes[i]));
+    for (size_t len = strlen(prefixes[i]); len <= sizeof(zeroed); len += 16) {
+      jsont_reset(S, zeroed, len);
+      assert(jsont_next(S) == JSONT_ARRAY_START);
+      assert(jsont_next(S) == JSONT_ERR);
+      assert(strcmp(jsont_error_info(S), "Premature end of input") == 0);
+    }
+  }
+
+  // Padded input is read a block at a time, with the same results
+  inbuf = "[\"a long string with \\\"quotes\\\" in it\", 1.5] \"abc";
+  size_t inlen = strlen(inbuf);
+  uint8_t* padded = jsont_alloc_padded(inlen);
+  memcpy(padded, inbuf, inlen);
+  jsont_reset_padded(S, padded, inlen);
+  assert(jsont_next(S) == JSONT_ARRAY_START);
+  assert(jsont_next(S) == JSONT_STRING);
+  assert(jsont_str_equals(S, "a long string with \"quotes\" in it") == true);
+  assert(jsont_next(S) == JSONT_NUMBER_FLOAT);
+  assert(jsont_float_value(S) == 1.5);
+  assert(jsont_next(S) == JSONT_ARRAY_END);
+  // the input ends in the middle of a string
+  assert(jsont_next(S) == JSONT_ERR);
+  assert(strcmp(jsont_error_info(S), "Unterminated string") == 0);
+  free(padded);
+
+  // Trailing commas, mismatched brackets and missing commas are errors
+  inbuf = "[1,]";
+  jsont_reset(S, (const uint8_t*)inbuf, strlen(inbuf));
+  assert(jsont_next(S) == JSONT_ARRAY_START);
+  assert(jsont_next(S) == JSONT_NUMBER_INT);
+  assert(jsont_next(S) == JSONT_ERR);
+  assert(jsont_error_info(S) != 0);
+  inbuf = "{\"a\":[1}";
+  jsont_reset(S, (const uint8_t*)inbuf, strlen(inbuf));
+  assert(jsont_next(S) == JSONT_OBJECT_START);
+  assert(jsont_next(S) == JSONT_FIELD_NAME);
+  assert(jsont_next(S) == JSONT_ARRAY_START);
+  assert(jsont_next(S) == JSONT_NUMBER_INT);
+  assert(jsont_next(S) == JSONT_ERR);
+  assert(jsont_current_offset(S) == 8);
+  inbuf = "{\"a\" 1}";
+  jsont_reset(S, (const uint8_t*)inbuf, strlen(inbuf));
+  assert(jsont_next(S) == JSONT_OBJECT_START);
+  assert(jsont_next(S) == JSONT_ERR);
+  inbuf = "[true false]";
+  jsont_reset(S, (const uint8_t*)inbuf, strlen(inbuf));
+  assert(jsont_next(S) == JSONT_ARRAY_START);
+  assert(jsont_next(S) == JSONT_TRUE);
+  assert(jsont_next(S) == JSONT_ERR);
+
+  // A number at the end of the input is read in full
+  inbuf = "[1] -2.5";
+  jsont_reset(S, (const uint8_t*)inbuf, strlen(inbuf));
+  assert(jsont_next_batch(S, records, 4) == 4);
+  assert(records[3].tok == JSONT_NUMBER_FLOAT && records[3].length == 4);
+  assert(jsont_float_value(S) == -2.5);
+  assert(jsont_next(S) == JSONT_END);
+
+  // A NUL byte ends the input, e.g. for a zero-filled buffer passed in full
+  uint8_t zeroed[16] = "[1,2]";
+  jsont_reset(S, zeroed, sizeof(zeroed));
+  assert(jsont_next(S) == JSONT_ARRAY_START);
+  assert(jsont_next(S) == JSONT_NUMBER_INT);
+  assert(jsont_next(S) == JSONT_NUMBER_INT);
+  assert(jsont_next(S) == JSONT_ARRAY_END);
+  assert(jsont_next(S) == JSONT_END);
+  assert(jsont_current_offset(S) == 5);
+  assert(jsont_error_info(S) == 0);
+  assert(jsont_next(S) == JSONT_END);
+  assert(jsont_current_offset(S) == 5);
+  // and so input ending inside a token, there or at `length`, is an error
+  const char* truncated[] = {"[\"ab\0cd\"]", "[\"ab\\\0\"]", "[tr\0e]",
+                             "{\"a\"\0:1}"};
+  for (size_t i = 0; i < sizeof(truncated) / sizeof(truncated[0]); ++i) {
+    size_t nul = strlen(truncated[i]);
+    for (size_t len = nul; len <= nul + 3; len += 3) {
+      jsont_reset(S, (const uint8_t*)truncated[i], len);
+      assert(jsont_next(S) == (truncated[i][0] == '[' ? JSONT_ARRAY_START
+                                                      : JSONT_OBJECT_START));
+      assert(jsont_next(S) == JSONT_ERR);
+    }
+  }
+  inbuf = "[\"ab";
+  jsont_reset(S, (const uint8_t*)inbuf, strlen(inbuf));
+  assert(jsont_next(S) == JSONT_ARRAY_START);
+  assert(jsont_next(S) == JSONT_ERR);
+  assert(strcmp(jsont_error_info(S), "Unterminated string") == 0);
+
 
   jsont_destroy(S);
   printf("PASS\n");